@@ -0,0 +1,50 @@
+#include "AllocationCounter.hpp"
+#include <new>
+#include <cstdlib>
+
+/*
+ * Replaces global new and delete to count allocations for bench. Linked into the bench binary only,
+ * never into bin, so servers and clients keep the library allocator. Costs one relaxed increment.
+ */
+static const bool gRegistered = (gCountingAllocations = true);
+
+void *operator new(size_t size)
+{
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    size_t align = (size_t)alignment;
+    if (void *p = std::aligned_alloc(align, (size + align - 1) / align * align))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
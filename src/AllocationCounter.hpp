@@ -0,0 +1,10 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Heap allocations so far in the process. Only the bench build links AllocationCounter.cpp, which
+ * replaces global new to count them; everywhere else the count stays 0 and counting is false.
+ */
+extern std::atomic<uint64_t> gAllocations;
+extern bool gCountingAllocations;
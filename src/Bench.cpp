@@ -0,0 +1,769 @@
+#include "Bench.hpp"
+#include "PlayerStore.hpp"
+#include "SpatialGrid.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "AllocationCounter.hpp"
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+std::atomic<uint64_t> gAllocations{0};
+bool gCountingAllocations = false;
+
+/* Reaches the private step phases and interpolation, so they can be timed on their own */
+struct BenchAccess
+{
+    static void CheckPlayerCollisions(Server &server)
+    {
+        server.CheckPlayerCollisions();
+    }
+
+    static void CheckDotCollisions(Server &server)
+    {
+        server.CheckDotCollisions();
+    }
+
+    static PlayerStore &World(Server &server)
+    {
+        return server.mWorld;
+    }
+
+    static uint64_t BytesOut(Server &server)
+    {
+        return server.mMetrics.bytesOut.Load();
+    }
+
+    /* Snapshots are still encoded and counted, they just never reach the kernel */
+    static void SetOffline(Server &server)
+    {
+        server.mOffline = true;
+    }
+
+    static Vector2 Interpolate(Client &client, Player &player, double renderTime)
+    {
+        return client.GetInterpolatedPosition(player, renderTime);
+    }
+};
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /* Every random input is drawn from this, so runs are comparable between builds */
+    constexpr uint32_t seed = 1;
+
+    struct Result
+    {
+        double nsPerOp;
+        /* NaN outside the bench build, which is the only one counting */
+        double allocsPerOp;
+        uint64_t ops;
+        /* Egress per connected client per op, NaN for benchmarks that don't send */
+        double bytesPerClient{NAN};
+    };
+
+    /* Keeps the compiler from dropping a result nobody reads */
+    template <typename T>
+    void Sink(const T &value)
+    {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    /*
+     * Runs body in doubling batches until one batch takes at least minTime, then reports that batch.
+     * Batching keeps the clock reads out of the per op cost of short bodies.
+     */
+    template <typename F>
+    Result Time(F &&body, std::chrono::milliseconds minTime = std::chrono::milliseconds(200))
+    {
+        body();
+
+        for (uint64_t ops = 1;; ops *= 2)
+        {
+            uint64_t allocations = gAllocations.load(std::memory_order_relaxed);
+            auto start = Clock::now();
+            for (uint64_t i = 0; i < ops; i++)
+            {
+                body();
+            }
+            auto elapsed = Clock::now() - start;
+
+            if (elapsed >= minTime)
+            {
+                return {.nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / ops,
+                        .allocsPerOp = gCountingAllocations
+                                           ? (double)(gAllocations.load(std::memory_order_relaxed) - allocations) / ops
+                                           : NAN,
+                        .ops = ops};
+            }
+        }
+    }
+
+    /*
+     * Time() for bodies that need fresh state before every op: setup runs outside the clock and the
+     * allocation count, so only body is reported. Two clock reads an op, for bodies far longer than that
+     */
+    template <typename S, typename F>
+    Result TimeEach(S &&setup, F &&body, std::chrono::milliseconds minTime = std::chrono::milliseconds(200))
+    {
+        setup();
+        body();
+
+        for (uint64_t ops = 1;; ops *= 2)
+        {
+            Clock::duration elapsed{0};
+            uint64_t allocations = 0;
+            for (uint64_t i = 0; i < ops; i++)
+            {
+                setup();
+                uint64_t before = gAllocations.load(std::memory_order_relaxed);
+                auto start = Clock::now();
+                body();
+                elapsed += Clock::now() - start;
+                allocations += gAllocations.load(std::memory_order_relaxed) - before;
+            }
+
+            if (elapsed >= minTime)
+            {
+                return {.nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / ops,
+                        .allocsPerOp = gCountingAllocations ? (double)allocations / ops : NAN,
+                        .ops = ops};
+            }
+        }
+    }
+
+    void Fill(PlayerStore &store, size_t players, std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<float> x(-(WORLD_WIDTH / 2), WORLD_WIDTH / 2);
+        std::uniform_real_distribution<float> y(-(WORLD_HEIGHT / 2), WORLD_HEIGHT / 2);
+        std::uniform_int_distribution<uint32_t> radius(10, 40);
+
+        store.Reserve(players);
+        for (size_t i = 0; i < players; i++)
+        {
+            store.Reset(i, {WorldX::Quantize(x(rng)), WorldY::Quantize(y(rng))}, radius(rng));
+        }
+    }
+
+    /* A full tick of movement: ten rounds of one ten-input entry per player */
+    template <typename Kernel>
+    Result MovementTick(size_t players, Kernel kernel)
+    {
+        std::mt19937 rng(seed);
+        PlayerStore store;
+        Fill(store, players, rng);
+
+        std::vector<uint8_t> inputs(players * INPUT_BUFFER_SIZE);
+        for (auto &input : inputs)
+        {
+            input = rng() & 0x0f;
+        }
+
+        return Time([&]()
+                    {
+                        for (int round = 0; round < 10; round++)
+                        {
+                            for (int row = 0; row < INPUT_BUFFER_SIZE; row++)
+                            {
+                                kernel(store.x.data(), store.y.data(), store.radius.data(), &inputs[row * players], players);
+                            }
+                        } });
+    }
+
+    /* Every player's broadphase query and narrowphase distances */
+    Result CollisionTick(size_t players)
+    {
+        std::mt19937 rng(seed);
+        PlayerStore store;
+        Fill(store, players, rng);
+
+        SpatialGrid grid(32.0f);
+        std::vector<uint32_t> candidates;
+        std::vector<float> distances;
+        size_t hits = 0;
+
+        Result result = Time([&]()
+                             {
+                                 grid.Clear();
+                                 for (size_t i = 0; i < players; i++)
+                                 {
+                                     grid.Insert(i, store.Position(i));
+                                 }
+
+                                 for (size_t i = 0; i < players; i++)
+                                 {
+                                     candidates.clear();
+                                     grid.Query(store.Position(i), store.radius[i], candidates);
+                                     distances.resize(candidates.size());
+                                     DistanceSquared(store.x.data(), store.y.data(), 1, candidates.data(), candidates.size(),
+                                                     store.x[i], store.y[i], distances.data());
+
+                                     float radius = store.radius[i];
+                                     for (float distance : distances)
+                                     {
+                                         hits += distance < radius * radius;
+                                     }
+                                 } });
+        Sink(hits);
+        return result;
+    }
+
+    Result SingleInput()
+    {
+        std::mt19937 rng(seed);
+        std::vector<uint8_t> inputs(1024);
+        for (auto &input : inputs)
+        {
+            input = rng() & 0x0f;
+        }
+
+        Vector2 position{0, 0};
+        size_t i = 0;
+        Result result = Time([&]()
+                             { ApplyInput(&position, inputs[i++ & 1023], 10); });
+        Sink(position);
+        return result;
+    }
+
+    /*
+     * A hosted server with players connected from closed local ports, fed one input entry and one ack
+     * per player before each tick, like a full room of real clients. Offline unless sockets is set, so
+     * a tick's datagrams are counted rather than sent to loopback
+     */
+    struct ServerFixture
+    {
+        UdpSocket endpoint;
+        std::unique_ptr<Server> server;
+        std::vector<sockaddr_in> players;
+        std::mt19937 rng{seed};
+        uint64_t sequence{0};
+        uint32_t ticks{0};
+
+        explicit ServerFixture(size_t playerCount, bool sockets = false)
+        {
+            endpoint.Create("127.0.0.1", 0);
+            server = std::make_unique<Server>(endpoint);
+            if (!sockets)
+            {
+                BenchAccess::SetOffline(*server);
+            }
+            server->SetMaxPlayers(playerCount);
+            server->SetSeed(seed);
+            server->Start();
+
+            auto connect = Encode(PacketHeader{.type = MSG::CONNECT});
+            for (size_t i = 0; i < playerCount; i++)
+            {
+                players.push_back(UdpSocket::CreateAddress("127.0.0.1", 40000 + i));
+                server->Deliver(connect.data, connect.size, players.back());
+            }
+            Tick();
+        }
+
+        void Feed()
+        {
+            PlayerUpdatePacket update;
+            update.entry.sequenceNum = sequence;
+            SnapshotAckPacket ack;
+            ack.snapshotId = ticks - 1;
+
+            for (auto &player : players)
+            {
+                for (auto &input : update.entry.input)
+                {
+                    input = rng() & 0x0f;
+                }
+                auto encoded = Encode(update);
+                server->Deliver(encoded.data, encoded.size, player);
+
+                auto encodedAck = Encode(ack);
+                server->Deliver(encodedAck.data, encodedAck.size, player);
+            }
+            sequence += INPUT_BUFFER_SIZE;
+        }
+
+        /* Only the server's part, Feed() first */
+        void Step()
+        {
+            server->Tick();
+            ticks++;
+        }
+
+        void Tick()
+        {
+            Feed();
+            Step();
+        }
+    };
+
+    /*
+     * The server's tick alone, the clients' encoding and delivery stay outside the clock. Warmed until
+     * the snapshot history and every client's sent views have wrapped, so allocations are the steady state's
+     */
+    Result ServerTick(size_t players, bool sockets)
+    {
+        ServerFixture fixture(players, sockets);
+        while (fixture.ticks < 32)
+        {
+            fixture.Tick();
+        }
+        return TimeEach([&]()
+                        { fixture.Feed(); },
+                        [&]()
+                        { fixture.Step(); });
+    }
+
+    /*
+     * The same room culled by different interest radii, a smaller view means fewer entries per snapshot.
+     * Everyone joins at the origin, so players are scattered over the world first. Radii are put back
+     * every tick, players that kept eating would outgrow the world and crowd its centre again
+     */
+    Result SnapshotBytes(size_t players, float radius)
+    {
+        ServerFixture fixture(players);
+        PlayerStore &world = BenchAccess::World(*fixture.server);
+        Fill(world, players, fixture.rng);
+        fixture.server->SetInterestRadius(radius, radius * (DEFAULT_INTEREST_EXIT_RADIUS / DEFAULT_INTEREST_RADIUS));
+        auto setup = [&]()
+        {
+            std::fill(world.radius.begin(), world.radius.end(), 10);
+            fixture.Feed();
+        };
+        setup();
+        fixture.Step();
+
+        const uint64_t bytes = BenchAccess::BytesOut(*fixture.server);
+        const uint32_t ticks = fixture.ticks;
+        Result result = TimeEach(setup, [&]()
+                                 { fixture.Step(); });
+        result.bytesPerClient = (double)(BenchAccess::BytesOut(*fixture.server) - bytes) / (fixture.ticks - ticks) / players;
+        return result;
+    }
+
+    /* Radii are all equal, so nobody gets eaten and every run sees the same world */
+    Result PlayerCollisions(size_t players)
+    {
+        ServerFixture fixture(players);
+        PlayerStore &world = BenchAccess::World(*fixture.server);
+        std::fill(world.radius.begin(), world.radius.end(), 10);
+
+        return Time([&]()
+                    { BenchAccess::CheckPlayerCollisions(*fixture.server); });
+    }
+
+    /* Eaten dots respawn from the seeded generator, radii are put back so growth doesn't skew later runs */
+    Result DotCollisions(size_t players)
+    {
+        ServerFixture fixture(players);
+        PlayerStore &world = BenchAccess::World(*fixture.server);
+        std::fill(world.radius.begin(), world.radius.end(), 10);
+        BenchAccess::CheckPlayerCollisions(*fixture.server);
+
+        return Time([&]()
+                    {
+                        std::fill(world.radius.begin(), world.radius.end(), 10);
+                        BenchAccess::CheckDotCollisions(*fixture.server); });
+    }
+
+    /* A world of players that just joined, every op starts from it again so growth doesn't skew later runs */
+    Result LockstepApply(size_t players)
+    {
+        LockstepWorld base;
+        base.Reset(seed);
+        LockstepFrame join;
+        for (size_t i = 0; i < players; i++)
+        {
+            join.joins.push_back(20000 + i);
+        }
+        join.inputs.assign(players, 0);
+        base.Apply(join);
+
+        std::mt19937 rng(seed);
+        LockstepFrame frame;
+        for (size_t i = 0; i < players; i++)
+        {
+            frame.inputs.push_back(rng() & 0x0f);
+        }
+
+        LockstepWorld world = base;
+        return Time([&]()
+                    {
+                        world = base;
+                        world.Apply(frame);
+                        Sink(world.Frame()); });
+    }
+
+    Result LockstepChecksum(size_t players)
+    {
+        LockstepWorld world;
+        world.Reset(seed);
+        LockstepFrame join;
+        for (size_t i = 0; i < players; i++)
+        {
+            join.joins.push_back(20000 + i);
+        }
+        join.inputs.assign(players, 0);
+        world.Apply(join);
+
+        return Time([&]()
+                    {
+                        uint32_t checksum = world.Checksum();
+                        Sink(checksum); });
+    }
+
+    Result BufferPush()
+    {
+        CircularBuffer<Position> buffer(32);
+        float time = 0;
+        return Time([&]()
+                    { buffer.push({{time, time}, time}); time += 1; });
+    }
+
+    Result BufferPushPop()
+    {
+        CircularBuffer<Position> buffer(32);
+        float time = 0;
+        Position last{};
+        Result result = Time([&]()
+                             {
+                                 buffer.push({{time, time}, time});
+                                 last = buffer.pop();
+                                 time += 1; });
+        Sink(last);
+        return result;
+    }
+
+    Result BufferAt()
+    {
+        CircularBuffer<Position> buffer(32);
+        for (int i = 0; i < 40; i++)
+        {
+            buffer.push({{(float)i, (float)i}, (float)i});
+        }
+
+        size_t i = 0;
+        float sum = 0;
+        Result result = Time([&]()
+                             { sum += buffer.at(i++ & 31).time; });
+        Sink(sum);
+        return result;
+    }
+
+    Result StaticBufferPush()
+    {
+        CircularBuffer<Position, 32> buffer;
+        float time = 0;
+        Result result = Time([&]()
+                             { buffer.push({{time, time}, time}); time += 1; });
+        /* Inline storage nobody reads would let the pushes go entirely */
+        Sink(buffer.back());
+        return result;
+    }
+
+    Result StaticBufferPushPop()
+    {
+        CircularBuffer<Position, 32> buffer;
+        float time = 0;
+        Position last{};
+        Result result = Time([&]()
+                             {
+                                 buffer.push({{time, time}, time});
+                                 last = buffer.pop();
+                                 time += 1; });
+        Sink(last);
+        return result;
+    }
+
+    Result StaticBufferIndex()
+    {
+        CircularBuffer<Position, 32> buffer;
+        for (int i = 0; i < 40; i++)
+        {
+            buffer.push({{(float)i, (float)i}, (float)i});
+        }
+
+        size_t i = 0;
+        float sum = 0;
+        Result result = Time([&]()
+                             { sum += buffer[i++ & 31].time; });
+        Sink(sum);
+        return result;
+    }
+
+    /* A wrapped history copied out whole, two memcpys instead of one index computation per item */
+    Result StaticBufferCopy()
+    {
+        CircularBuffer<Position, 32> buffer;
+        for (int i = 0; i < 40; i++)
+        {
+            buffer.push({{(float)i, (float)i}, (float)i});
+        }
+
+        Position out[32];
+        Result result = Time([&]()
+                             {
+                                 auto [first, second] = buffer.spans();
+                                 memcpy(out, first.data(), first.size_bytes());
+                                 memcpy(out + first.size(), second.data(), second.size_bytes());
+                                 Sink(out[31]); });
+        return result;
+    }
+
+    /* A full history 100ms apart, render times swept across it so every bracket gets searched */
+    Result Interpolate()
+    {
+        Client client(0, 0);
+        Player player{.id = 1};
+        for (int i = 0; i < 10; i++)
+        {
+            player.Push({{i * 3.0f, i * 2.0f}, i * 100.0f});
+        }
+
+        double renderTime = 0;
+        Vector2 position{};
+        Result result = Time([&]()
+                             {
+                                 position = BenchAccess::Interpolate(client, player, renderTime);
+                                 renderTime = renderTime >= 890.0 ? 0.0 : renderTime + 7.0; });
+        Sink(position);
+        return result;
+    }
+
+    template <typename Packet>
+    Result EncodePacket(const Packet &packet)
+    {
+        Encoded<Packet> encoded;
+        Result result = Time([&]()
+                             {
+                                 encoded = Encode(packet);
+                                 Sink(encoded); });
+        return result;
+    }
+
+    template <typename Packet>
+    Result DecodePacket(const Packet &packet)
+    {
+        auto encoded = Encode(packet);
+        Packet decoded;
+        bool ok = true;
+        Result result = Time([&]()
+                             {
+                                 ok &= Decode(encoded.data, encoded.size, decoded);
+                                 Sink(decoded); });
+        Sink(ok);
+        return result;
+    }
+
+    /* A full snapshot fragment: header and as many complete entries as fit in a datagram */
+    Result EncodeWorldFragment(std::vector<PlayerState> &players)
+    {
+        char buffer[MAX_DATAGRAM_SIZE];
+        WorldUpdatePacket header{.snapshotId = 1, .baselineId = NO_BASELINE, .time = 0, .processedInputs = 0, .fragmentIndex = 0,
+                                 .fragmentCount = 1, .entryCount = (uint16_t)players.size()};
+        size_t bytes = 0;
+
+        Result result = Time([&]()
+                             {
+                                 BitWriter writer(buffer, sizeof(buffer));
+                                 SchemaOf<WorldUpdatePacket>::Type::Write(writer, header);
+                                 for (auto &player : players)
+                                 {
+                                     WriteDeltaEntry(writer, DELTA_POSITION | DELTA_RADIUS, player);
+                                 }
+                                 bytes += writer.BytesWritten();
+                                 Sink(buffer); });
+        Sink(bytes);
+        return result;
+    }
+
+    Result DecodeWorldFragment(std::vector<PlayerState> &players)
+    {
+        char buffer[MAX_DATAGRAM_SIZE];
+        WorldUpdatePacket header{.snapshotId = 1, .baselineId = NO_BASELINE, .time = 0, .processedInputs = 0, .fragmentIndex = 0,
+                                 .fragmentCount = 1, .entryCount = (uint16_t)players.size()};
+        BitWriter writer(buffer, sizeof(buffer));
+        SchemaOf<WorldUpdatePacket>::Type::Write(writer, header);
+        for (auto &player : players)
+        {
+            WriteDeltaEntry(writer, DELTA_POSITION | DELTA_RADIUS, player);
+        }
+        size_t size = writer.BytesWritten();
+
+        PlayerState entry{};
+        Result result = Time([&]()
+                             {
+                                 BitReader reader(buffer, size);
+                                 WorldUpdatePacket decoded;
+                                 SchemaOf<WorldUpdatePacket>::Type::Read(reader, decoded);
+                                 for (int i = 0; i < decoded.entryCount; i++)
+                                 {
+                                     uint8_t flags;
+                                     ReadDeltaEntry(reader, flags, entry);
+                                 }
+                                 Sink(entry); });
+        return result;
+    }
+
+    class Suite
+    {
+        const BenchOptions &mOptions;
+
+    public:
+        explicit Suite(const BenchOptions &options) : mOptions(options)
+        {
+            if (mOptions.json)
+            {
+                std::cout << "{\"isa\":\"" << KernelIsa() << "\",\"seed\":" << seed << "}\n";
+            }
+            else
+            {
+                std::cout << "Kernels: " << KernelIsa() << ", seed " << seed << "\n"
+                          << std::left << std::setw(36) << "benchmark" << std::right << std::setw(16) << "ns/op"
+                          << std::setw(14) << "allocs/op" << std::setw(14) << "ops" << std::setw(14) << "B/client" << "\n";
+            }
+        }
+
+        template <typename F>
+        void Run(const std::string &name, F &&bench)
+        {
+            if (name.find(mOptions.filter) == std::string::npos)
+            {
+                return;
+            }
+
+            Result result = bench();
+            if (mOptions.json)
+            {
+                std::cout << std::fixed << std::setprecision(3) << "{\"name\":\"" << name << "\",\"ns_per_op\":" << result.nsPerOp
+                          << ",\"allocs_per_op\":";
+                if (std::isnan(result.allocsPerOp))
+                {
+                    std::cout << "null";
+                }
+                else
+                {
+                    std::cout << result.allocsPerOp;
+                }
+                std::cout << ",\"ops\":" << result.ops << ",\"bytes_per_client\":";
+                if (std::isnan(result.bytesPerClient))
+                {
+                    std::cout << "null";
+                }
+                else
+                {
+                    std::cout << result.bytesPerClient;
+                }
+                std::cout << "}\n";
+            }
+            else
+            {
+                std::cout << std::fixed << std::setprecision(1) << std::left << std::setw(36) << name << std::right
+                          << std::setw(16) << result.nsPerOp << std::setprecision(3) << std::setw(14);
+                if (std::isnan(result.allocsPerOp))
+                {
+                    std::cout << "-";
+                }
+                else
+                {
+                    std::cout << result.allocsPerOp;
+                }
+                std::cout << std::setw(14) << result.ops << std::setprecision(1) << std::setw(14);
+                if (std::isnan(result.bytesPerClient))
+                {
+                    std::cout << "-";
+                }
+                else
+                {
+                    std::cout << result.bytesPerClient;
+                }
+                std::cout << "\n";
+            }
+            std::cout.flush();
+        }
+    };
+}
+
+int RunBenchmarks(const BenchOptions &options)
+{
+    Suite suite(options);
+
+    suite.Run("input/apply", SingleInput);
+    for (size_t players : {1000, 10000})
+    {
+        std::string suffix = "/" + std::to_string(players);
+        suite.Run("input/movement_tick_scalar" + suffix, [&]()
+                  { return MovementTick(players, ApplyInputsScalar); });
+        suite.Run("input/movement_tick_simd" + suffix, [&]()
+                  { return MovementTick(players, ApplyInputs); });
+        suite.Run("collision/tick" + suffix, [&]()
+                  { return CollisionTick(players); });
+    }
+
+    for (size_t players : {16, 128, 1024})
+    {
+        std::string suffix = "/" + std::to_string(players);
+        suite.Run("server/tick" + suffix, [&]()
+                  { return ServerTick(players, false); });
+        /* The same tick flushing to loopback, the difference is what sending costs */
+        suite.Run("server/tick_sockets" + suffix, [&]()
+                  { return ServerTick(players, true); });
+        for (float radius : {500.0f, DEFAULT_INTEREST_RADIUS, 100.0f})
+        {
+            suite.Run("server/snapshot_bytes" + suffix + "/radius_" + std::to_string((int)radius), [&]()
+                      { return SnapshotBytes(players, radius); });
+        }
+        suite.Run("server/player_collisions" + suffix, [&]()
+                  { return PlayerCollisions(players); });
+        suite.Run("server/dot_collisions" + suffix, [&]()
+                  { return DotCollisions(players); });
+        suite.Run("lockstep/apply" + suffix, [&]()
+                  { return LockstepApply(players); });
+        suite.Run("lockstep/checksum" + suffix, [&]()
+                  { return LockstepChecksum(players); });
+    }
+
+    suite.Run("circular_buffer/push", BufferPush);
+    suite.Run("circular_buffer/push_pop", BufferPushPop);
+    suite.Run("circular_buffer/at", BufferAt);
+    suite.Run("circular_buffer/static/push", StaticBufferPush);
+    suite.Run("circular_buffer/static/push_pop", StaticBufferPushPop);
+    suite.Run("circular_buffer/static/index", StaticBufferIndex);
+    suite.Run("circular_buffer/static/copy", StaticBufferCopy);
+    suite.Run("client/interpolate", Interpolate);
+
+    PlayerUpdatePacket update{};
+    update.entry.sequenceNum = 12345;
+    DotUpdatePacket dots{};
+    for (int i = 0; i < DOT_COUNT; i++)
+    {
+        dots.positions[i] = {i * 10.0f, i * -5.0f};
+    }
+    std::mt19937 rng(seed);
+    std::vector<PlayerState> players;
+    size_t entries = (MAX_DATAGRAM_SIZE * 8 - SchemaOf<WorldUpdatePacket>::Type::bits) / MAX_DELTA_ENTRY_BITS;
+    for (size_t i = 0; i < entries; i++)
+    {
+        players.push_back({.id = (int)(20000 + i),
+                           .position = {WorldX::Quantize((float)(rng() % WORLD_WIDTH) - WORLD_WIDTH / 2),
+                                        WorldY::Quantize((float)(rng() % WORLD_HEIGHT) - WORLD_HEIGHT / 2)},
+                           .radius = (uint32_t)(10 + rng() % 30)});
+    }
+
+    suite.Run("packet/encode_player_update", [&]()
+              { return EncodePacket(update); });
+    suite.Run("packet/decode_player_update", [&]()
+              { return DecodePacket(update); });
+    suite.Run("packet/encode_dot_update", [&]()
+              { return EncodePacket(dots); });
+    suite.Run("packet/decode_dot_update", [&]()
+              { return DecodePacket(dots); });
+    suite.Run("packet/encode_world_fragment", [&]()
+              { return EncodeWorldFragment(players); });
+    suite.Run("packet/decode_world_fragment", [&]()
+              { return DecodeWorldFragment(players); });
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+
+struct BenchOptions
+{
+    /* One JSON object per line instead of a table, for tracking results between releases */
+    bool json{false};
+    /* Only benchmarks whose name contains this */
+    std::string filter;
+};
+
+/* Times the server and client hot paths and prints ns and allocations per op, returns the process exit code */
+int RunBenchmarks(const BenchOptions &options);
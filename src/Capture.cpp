@@ -0,0 +1,197 @@
+#include "Capture.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+    /* Grown a chunk at a time, a busy server captures megabytes a second */
+    constexpr size_t captureChunk = 64 << 20;
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+}
+
+bool CaptureWriter::Open(const std::string &path, const CaptureHeader &header)
+{
+    Close();
+
+    mFd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFd < 0)
+    {
+        std::cerr << "Couldn't open capture " << path << ": " << strerror(errno) << '\n';
+        return false;
+    }
+
+    if (!Reserve(sizeof(header)))
+    {
+        Close();
+        return false;
+    }
+    Append(&header, sizeof(header));
+    return true;
+}
+
+bool CaptureWriter::Reserve(size_t bytes)
+{
+    if (mUsed + bytes <= mMapped)
+    {
+        return true;
+    }
+
+    /* Remapped whole rather than with mremap, which macOS doesn't have */
+    size_t size = std::max(mMapped + captureChunk, mUsed + bytes);
+    if (mMap)
+    {
+        munmap(mMap, mMapped);
+        mMap = nullptr;
+    }
+    /* Closed on failure, keeping what was written, so later records are turned away rather than written nowhere */
+    if (ftruncate(mFd, size) != 0)
+    {
+        std::cerr << "Couldn't grow capture: " << strerror(errno) << '\n';
+        Close();
+        return false;
+    }
+
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (map == MAP_FAILED)
+    {
+        std::cerr << "Couldn't map capture: " << strerror(errno) << '\n';
+        Close();
+        return false;
+    }
+    mMap = (char *)map;
+    mMapped = size;
+    return true;
+}
+
+void CaptureWriter::Append(const void *data, size_t size)
+{
+    memcpy(mMap + mUsed, data, size);
+    mUsed += size;
+}
+
+void CaptureWriter::WriteDatagram(const char *data, uint16_t size, uint32_t address, uint16_t port, uint8_t shard, float arrival)
+{
+    if (mFd < 0 || !Reserve(sizeof(CaptureRecord) + size))
+    {
+        return;
+    }
+
+    CaptureRecord record{.kind = CaptureKind::DATAGRAM, .shard = shard, .size = size, .address = address,
+                         .port = port, .reserved = 0, .arrival = arrival};
+    Append(&record, sizeof(record));
+    Append(data, size);
+}
+
+void CaptureWriter::WriteTick(uint64_t tick, double time)
+{
+    if (mFd < 0 || !Reserve(sizeof(CaptureRecord) + sizeof(CaptureTick)))
+    {
+        return;
+    }
+
+    CaptureRecord record{.kind = CaptureKind::TICK, .shard = 0, .size = sizeof(CaptureTick), .address = 0,
+                         .port = 0, .reserved = 0, .arrival = 0};
+    CaptureTick marker{.tick = tick, .time = time};
+    Append(&record, sizeof(record));
+    Append(&marker, sizeof(marker));
+}
+
+void CaptureWriter::Close()
+{
+    if (mMap)
+    {
+        munmap(mMap, mMapped);
+        mMap = nullptr;
+    }
+    if (mFd >= 0)
+    {
+        if (ftruncate(mFd, mUsed) != 0)
+        {
+            std::cerr << "Couldn't trim capture: " << strerror(errno) << '\n';
+        }
+        close(mFd);
+        mFd = -1;
+    }
+    mMapped = 0;
+    mUsed = 0;
+}
+
+CaptureReader::~CaptureReader()
+{
+    if (mMap)
+    {
+        munmap((void *)mMap, mSize);
+    }
+    if (mFd >= 0)
+    {
+        close(mFd);
+    }
+}
+
+bool CaptureReader::Open(const std::string &path)
+{
+    mFd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (mFd < 0 || fstat(mFd, &info) != 0 || (size_t)info.st_size < sizeof(CaptureHeader))
+    {
+        std::cerr << "Couldn't open capture " << path << '\n';
+        return false;
+    }
+
+    mSize = info.st_size;
+    void *map = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+    if (map == MAP_FAILED)
+    {
+        std::cerr << "Couldn't map capture: " << strerror(errno) << '\n';
+        return false;
+    }
+    mMap = (const char *)map;
+
+    memcpy(&mHeader, mMap, sizeof(mHeader));
+    if (memcmp(mHeader.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || mHeader.version != CAPTURE_VERSION)
+    {
+        std::cerr << path << " isn't a version " << CAPTURE_VERSION << " capture\n";
+        return false;
+    }
+
+    Rewind();
+    return true;
+}
+
+const CaptureHeader &CaptureReader::Header() const
+{
+    return mHeader;
+}
+
+bool CaptureReader::Next(CaptureRecord &record, const char *&payload)
+{
+    if (mOffset + sizeof(CaptureRecord) > mSize)
+    {
+        return false;
+    }
+
+    /* Every record has a payload, a zero size is the unwritten tail of a file that was never trimmed */
+    memcpy(&record, mMap + mOffset, sizeof(record));
+    if (record.size == 0 || mOffset + sizeof(CaptureRecord) + record.size > mSize)
+    {
+        return false;
+    }
+
+    payload = mMap + mOffset + sizeof(CaptureRecord);
+    mOffset += sizeof(CaptureRecord) + record.size;
+    return true;
+}
+
+void CaptureReader::Rewind()
+{
+    mOffset = sizeof(CaptureHeader);
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Server traffic capture: every inbound datagram as the server stamped it, and a marker before each
+ * tick, so bin replay can feed a real session back through the server with the same tick boundaries.
+ *
+ * The file is a CaptureHeader followed by records, each a CaptureRecord and size bytes of payload:
+ * the datagram, or a CaptureTick. Fields are in host byte order, addresses and ports as on the wire.
+ */
+
+constexpr char CAPTURE_MAGIC[8] = {'M', 'P', 'C', 'A', 'P', 'T', 'U', 'R'};
+constexpr uint32_t CAPTURE_VERSION = 2;
+
+struct CaptureHeader
+{
+    char magic[8];
+    uint32_t version;
+    /* What the server's generator was seeded with, dots and respawns replay from it */
+    uint32_t seed;
+    double tickRate;
+    int32_t maxPlayers;
+    uint32_t shards;
+    /* Non-zero for a server exchanging lockstep frames rather than snapshots */
+    uint32_t lockstep;
+};
+
+enum class CaptureKind : uint8_t
+{
+    DATAGRAM,
+    TICK
+};
+
+struct CaptureRecord
+{
+    CaptureKind kind;
+    uint8_t shard;
+    uint16_t size;
+    uint32_t address;
+    uint16_t port;
+    uint16_t reserved;
+    /* Milliseconds since the server started, exactly as ReceiveMessage stamped it */
+    float arrival;
+};
+
+struct CaptureTick
+{
+    uint64_t tick;
+    /* Milliseconds from the start to when the tick was due */
+    double time;
+};
+
+/*
+ * Appends to a file through a memory mapping that grows in chunks, so a record is a memcpy rather
+ * than a write call. Not thread safe, the server serializes writers itself. Close() trims the file
+ * to what was written.
+ */
+class CaptureWriter
+{
+    int mFd{-1};
+    char *mMap{nullptr};
+    size_t mMapped{0};
+    size_t mUsed{0};
+
+    bool Reserve(size_t bytes);
+    void Append(const void *data, size_t size);
+
+public:
+    CaptureWriter() = default;
+    CaptureWriter(const CaptureWriter &) = delete;
+    CaptureWriter &operator=(const CaptureWriter &) = delete;
+    ~CaptureWriter();
+
+    /* Truncates whatever was at path */
+    bool Open(const std::string &path, const CaptureHeader &header);
+    void WriteDatagram(const char *data, uint16_t size, uint32_t address, uint16_t port, uint8_t shard, float arrival);
+    void WriteTick(uint64_t tick, double time);
+    void Close();
+};
+
+/* Maps a whole capture read only and walks its records */
+class CaptureReader
+{
+    int mFd{-1};
+    const char *mMap{nullptr};
+    size_t mSize{0};
+    size_t mOffset{0};
+    CaptureHeader mHeader{};
+
+public:
+    CaptureReader() = default;
+    CaptureReader(const CaptureReader &) = delete;
+    CaptureReader &operator=(const CaptureReader &) = delete;
+    ~CaptureReader();
+
+    /* False if the file can't be mapped or isn't a capture of this version */
+    bool Open(const std::string &path);
+    const CaptureHeader &Header() const;
+
+    /* The next record and its payload. False at the end, or where a crash left a record cut short or zeroes */
+    bool Next(CaptureRecord &record, const char *&payload);
+
+    /* Back to the first record */
+    void Rewind();
+};
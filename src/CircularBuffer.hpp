@@ -3,9 +3,21 @@
 #include <stdexcept>
 #include <cstddef>
 #include <optional>
+#include <span>
+#include <bit>
+#include <algorithm>
+#include <utility>
+
+/*
+ * Ring buffer keeping the newest max_size() items, pushing onto a full one drops the oldest.
+ * CircularBuffer<T> sizes itself at run time on the heap. CircularBuffer<T, N> keeps N items inline,
+ * N a power of two so wrapping is a mask
+ */
+template <typename T, size_t N = 0>
+class CircularBuffer;
 
 template <typename T>
-class CircularBuffer
+class CircularBuffer<T, 0>
 {
 private:
     T *buffer;
@@ -128,6 +140,27 @@ public:
         tail = (tail + 1) % capacity;
     }
 
+    /*
+     * Makes room the way push() does and returns the new back slot, still holding the item it
+     * overwrote (or a default one), so callers can assign into it and keep its allocations
+     */
+    T &push_slot()
+    {
+        T &slot = buffer[tail];
+
+        if (size_ < capacity)
+        {
+            size_++;
+        }
+        else
+        {
+            head = (head + 1) % capacity;
+        }
+
+        tail = (tail + 1) % capacity;
+        return slot;
+    }
+
     T pop()
     {
         if (empty())
@@ -181,6 +214,17 @@ public:
         return buffer[actual_index];
     }
 
+    /* at() without the bounds check, for loops that already keep index below size() */
+    T &operator[](size_t index)
+    {
+        return buffer[(head + index) % capacity];
+    }
+
+    const T &operator[](size_t index) const
+    {
+        return buffer[(head + index) % capacity];
+    }
+
     bool empty() const
     {
         return size_ == 0;
@@ -208,3 +252,165 @@ public:
         size_ = 0;
     }
 };
+
+template <typename T, size_t N>
+class CircularBuffer
+{
+    static_assert(std::has_single_bit(N), "Capacity must be a power of two");
+    static constexpr size_t mask = N - 1;
+
+private:
+    T buffer[N]{};
+    size_t head{0};
+    size_t size_{0};
+
+public:
+    /* The items oldest first, in at most two runs: first up to the end of storage, second the wrapped rest */
+    struct Spans
+    {
+        std::span<T> first;
+        std::span<T> second;
+    };
+
+    struct ConstSpans
+    {
+        std::span<const T> first;
+        std::span<const T> second;
+    };
+
+    void push(const T &item)
+    {
+        buffer[(head + size_) & mask] = item;
+        if (size_ < N)
+        {
+            size_++;
+        }
+        else
+        {
+            head = (head + 1) & mask;
+        }
+    }
+
+    void push(T &&item)
+    {
+        buffer[(head + size_) & mask] = std::move(item);
+        if (size_ < N)
+        {
+            size_++;
+        }
+        else
+        {
+            head = (head + 1) & mask;
+        }
+    }
+
+    /* The new back slot, see CircularBuffer<T>::push_slot() */
+    T &push_slot()
+    {
+        T &slot = buffer[(head + size_) & mask];
+        if (size_ < N)
+        {
+            size_++;
+        }
+        else
+        {
+            head = (head + 1) & mask;
+        }
+        return slot;
+    }
+
+    /* pop(), front() and back() don't check, like the standard containers callers test empty() first */
+    T pop()
+    {
+        T item = std::move(buffer[head]);
+        head = (head + 1) & mask;
+        size_--;
+        return item;
+    }
+
+    T &front()
+    {
+        return buffer[head];
+    }
+
+    const T &front() const
+    {
+        return buffer[head];
+    }
+
+    T &back()
+    {
+        return buffer[(head + size_ - 1) & mask];
+    }
+
+    const T &back() const
+    {
+        return buffer[(head + size_ - 1) & mask];
+    }
+
+    T &at(size_t index)
+    {
+        if (index >= size_)
+        {
+            throw std::out_of_range("Index out of bounds");
+        }
+        return buffer[(head + index) & mask];
+    }
+
+    const T &at(size_t index) const
+    {
+        if (index >= size_)
+        {
+            throw std::out_of_range("Index out of bounds");
+        }
+        return buffer[(head + index) & mask];
+    }
+
+    T &operator[](size_t index)
+    {
+        return buffer[(head + index) & mask];
+    }
+
+    const T &operator[](size_t index) const
+    {
+        return buffer[(head + index) & mask];
+    }
+
+    Spans spans()
+    {
+        size_t first = std::min(size_, N - head);
+        return {{buffer + head, first}, {buffer, size_ - first}};
+    }
+
+    ConstSpans spans() const
+    {
+        size_t first = std::min(size_, N - head);
+        return {{buffer + head, first}, {buffer, size_ - first}};
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    bool full() const
+    {
+        return size_ == N;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    static constexpr size_t max_size()
+    {
+        return N;
+    }
+
+    void clear()
+    {
+        head = 0;
+        size_ = 0;
+    }
+};
@@ -1,16 +1,45 @@
 #include "Client.hpp"
 
-Client::Client(int port, int serverPort) : mPort(port)
+Client::Client(int port, int serverPort, size_t snapshotHistory) : mPort(port), mSnapshots(snapshotHistory)
 {
     mServerAddr = UdpSocket::CreateAddress("127.0.0.1", serverPort);
 }
 
-void Client::Attach()
+bool Client::CreateSocket()
 {
-
     if (!mSock.Create("127.0.0.1", mPort))
     {
         std::cerr << "Couldn't create socket\n";
+        return false;
+    }
+    return true;
+}
+
+void Client::Attach(EventLoop &loop)
+{
+    if (!CreateSocket())
+    {
+        return;
+    }
+
+    /* Keeps the receive buffers small, a load generator runs thousands of these */
+    mSock.SetBatchSize(4);
+    if (!mSock.StartReceiving(loop, [this](char *buffer, int bytesRead, sockaddr_in sender)
+                              { this->ReceiveMessage(buffer, bytesRead, sender); }))
+    {
+        std::cerr << "Failed to register socket with event loop\n";
+        return;
+    }
+
+    mRunning = true;
+    auto connectPacket = Encode(PacketHeader{.type = MSG::CONNECT});
+    mSock.SendTo(connectPacket.data, connectPacket.size, mServerAddr);
+}
+
+void Client::Attach(NetBackend backend)
+{
+    if (!CreateSocket())
+    {
         return;
     }
 
@@ -20,15 +49,23 @@ void Client::Attach()
         this->ReceiveMessage(buffer, bytesRead, sender);
     };
 
-    if (!mSock.StartReceiveThread(std::chrono::milliseconds(10), callback))
+    if (backend == NetBackend::EventLoop)
+    {
+        if (!mSock.StartReceiving(mLoop, callback) || !mLoop.Start())
+        {
+            std::cerr << "Failed to start event loop\n";
+            return;
+        }
+    }
+    else if (!mSock.StartReceiveThread(std::chrono::milliseconds(10), callback))
     {
         std::cerr << "Failed to start receive thread\n";
         return;
     }
 
     mRunning = true;
-    PacketHeader connectPacket = {.type = MSG::CONNECT};
-    mSock.SendTo(&connectPacket, sizeof(PacketHeader), mServerAddr);
+    auto connectPacket = Encode(PacketHeader{.type = MSG::CONNECT});
+    mSock.SendTo(connectPacket.data, connectPacket.size, mServerAddr);
 }
 
 void Client::ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender)
@@ -38,18 +75,44 @@ void Client::ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender)
         return;
     }
 
-    auto packet = reinterpret_cast<PacketHeader *>(buffer);
+    MSG type;
+    if (!PeekType(buffer, bytesRead, type))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStats.packetsReceived++;
+    }
 
-    switch (packet->type)
+    switch (type)
     {
     case MSG::TIME_SYNC:
     {
-        auto data = reinterpret_cast<TimeSyncPacket *>(buffer);
+        TimeSyncPacket data;
+        if (!Decode(buffer, bytesRead, data))
+        {
+            break;
+        }
 
-        mStartTime = std::chrono::high_resolution_clock::time_point(
-            std::chrono::nanoseconds(data->startTimeNanos));
+        if (!mHeadless)
+        {
+            std::cout << "Time sync - Server time: " << data.serverTime / 1000.0 << "ms\n";
+        }
+        break;
+    }
+    case MSG::TIME_PONG:
+    {
+        double now = LocalTime();
+        TimePongPacket data;
+        if (!Decode(buffer, bytesRead, data))
+        {
+            break;
+        }
 
-        std::cout << "Time sync - Server time: " << data->serverTime << "ms\n";
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClock.AddSample(data.clientSend / 1000.0, data.serverReceive / 1000.0, data.serverSend / 1000.0, now);
         break;
     }
     case MSG::DISCONNECT:
@@ -61,59 +124,465 @@ void Client::ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender)
     case MSG::WORLD_UPDATE:
     {
         std::lock_guard<std::mutex> lock(mMutex);
-        auto data = reinterpret_cast<WorldUpdatePacket *>(buffer);
-        for (int i = 0; i < data->playerCount; i++)
+        ReceiveSnapshotFragment(buffer, bytesRead);
+        break;
+    }
+    case MSG::LOCKSTEP_FRAMES:
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ReceiveLockstepFrames(buffer, bytesRead);
+        break;
+    }
+    case MSG::LOCKSTEP_STATE:
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ReceiveLockstepWorld(buffer, bytesRead);
+        break;
+    }
+    case MSG::DOT_UPDATE:
+    {
+        DotUpdatePacket data;
+        if (!Decode(buffer, bytesRead, data))
         {
+            break;
+        }
 
-            if (mPort == data->playerIds[i])
-            {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (int i = 0; i < DOT_COUNT; i++)
+        {
+            mDots[i] = data.positions[i];
+        }
+        mStats.dotUpdates++;
+        break;
+    }
 
-                Vector2 predictedPos = mSelf.position;
+    default:
+        break;
+    }
+}
 
-                mSelf.position = data->playerPositions[i];
-                mSelf.radius = data->playerRadius[i];
+void Client::ReceiveSnapshotFragment(char *buffer, int bytesRead)
+{
+    WorldUpdatePacket data;
+    BitReader reader(buffer, bytesRead);
+    SchemaOf<WorldUpdatePacket>::Type::Read(reader, data);
 
-                int i = mPredicted.size();
+    if (!reader.Ok())
+    {
+        return;
+    }
 
-                while (i--)
-                {
-                    auto input = mPredicted.front();
-                    if (input.sequenceNum > mLastSent)
-                    {
-                        ApplyInput(&mSelf.position, input.input, mSelf.radius);
-                    }
+    /* Acknowledges inputs even if the snapshot itself never completes */
+    AcknowledgeInputs(data.processedInputs);
 
-                    mPredicted.pop();
-                }
+    /* Already complete, or older than the newest complete one */
+    if (mHasSnapshot && (int32_t)(data.snapshotId - mSnapshotId) <= 0)
+    {
+        return;
+    }
+
+    if (!mPending.active || data.snapshotId != mPending.id)
+    {
+        /* A newer snapshot abandons an incomplete one, an older fragment is just late */
+        if (mPending.active && (int32_t)(data.snapshotId - mPending.id) < 0)
+        {
+            return;
+        }
 
-                if (predictedPos != mSelf.position)
+        const ClientSnapshot *baseline = nullptr;
+        if (data.baselineId != NO_BASELINE)
+        {
+            for (size_t i = 0; i < mSnapshots.size(); i++)
+            {
+                if (mSnapshots.at(i).id == data.baselineId)
                 {
-                    std::cout << "Misprediction\n";
+                    baseline = &mSnapshots.at(i);
+                    break;
                 }
+            }
 
-                continue;
+            /* Can't decode without it, the server falls back to a full snapshot once our ack ages out */
+            if (baseline == nullptr)
+            {
+                mPending.active = false;
+                return;
             }
+        }
+
+        mPending.active = true;
+        mPending.id = data.snapshotId;
+        mPending.time = data.time / 1000.0;
+        mPending.processedInputs = data.processedInputs;
+        mPending.players = baseline ? baseline->players : std::map<int, PlayerState>{};
+        mPending.received.assign(data.fragmentCount, false);
+        mPending.remaining = data.fragmentCount;
+    }
+
+    if (data.fragmentIndex >= mPending.received.size() || mPending.received[data.fragmentIndex])
+    {
+        return;
+    }
+
+    for (int i = 0; i < data.entryCount; i++)
+    {
+        uint8_t flags;
+        PlayerState entry{};
+        ReadDeltaEntry(reader, flags, entry);
 
-            mPlayers[data->playerIds[i]].positions.push({data->playerPositions[i], data->time});
-            mPlayers[data->playerIds[i]].radius = data->playerRadius[i];
+        /* Truncated or corrupt, the snapshot never completes and the next one replaces it */
+        if (!reader.Ok())
+        {
+            return;
         }
 
-        break;
+        if (flags & DELTA_REMOVED)
+        {
+            mPending.players.erase(entry.id);
+            continue;
+        }
+
+        /* Fields absent from the entry keep their baseline value */
+        auto [it, inserted] = mPending.players.try_emplace(entry.id, PlayerState{.id = entry.id, .position = {}, .radius = 10});
+        if (flags & DELTA_POSITION)
+        {
+            it->second.position = entry.position;
+        }
+        if (flags & DELTA_RADIUS)
+        {
+            it->second.radius = entry.radius;
+        }
     }
-    case MSG::DOT_UPDATE:
+
+    mPending.received[data.fragmentIndex] = true;
+    if (--mPending.remaining == 0)
+    {
+        CompleteSnapshot();
+    }
+}
+
+void Client::CompleteSnapshot()
+{
+    mPending.active = false;
+    mSnapshotId = mPending.id;
+    mHasSnapshot = true;
+    mSnapshots.push({.id = mPending.id, .players = std::move(mPending.players)});
+
+    SnapshotAckPacket ack;
+    ack.snapshotId = mSnapshotId;
+    auto encoded = Encode(ack);
+    mSock.SendTo(encoded.data, encoded.size, mServerAddr);
+    mStats.packetsSent++;
+    mStats.snapshots++;
+
+    if (mClock.Synced())
+    {
+        double now = mClock.ServerTime(LocalTime());
+        double latency = now - mPending.time;
+        mDelay.AddSnapshot(mPending.time, now);
+        mStats.latencySamples++;
+        mStats.latencySumMs += latency;
+        mStats.latencyMaxMs = std::max(mStats.latencyMaxMs, latency);
+    }
+
+    const ClientSnapshot &snapshot = mSnapshots.back();
+
+    std::erase_if(mPlayers, [&](const auto &player)
+                  { return !snapshot.players.contains(player.first); });
+
+    for (auto &[id, state] : snapshot.players)
+    {
+        if (mPort == id)
+        {
+            Reconcile(state, mPending.processedInputs);
+            continue;
+        }
+
+        mPlayers[id].Push({state.position, mPending.time});
+        mPlayers[id].radius = state.radius;
+    }
+}
+
+void Client::Reconcile(const PlayerState &state, uint64_t processedInputs)
+{
+    mSelf.radius = state.radius;
+    mStats.reconciliations++;
+
+    /* The server's state follows input processedInputs - 1, anything before that is settled */
+    while (!mPredicted.empty() && mPredicted.front().sequenceNum + 1 < processedInputs)
+    {
+        mPredicted.pop();
+    }
+
+    if (!mPredicted.empty() && mPredicted.front().sequenceNum + 1 == processedInputs)
+    {
+        /* The server sends its position quantized, the prediction has to be checked the same way */
+        bool agreed = WorldPositionCodec::Quantize(mPredicted.front().position) == state.position;
+        mPredicted.pop();
+        if (agreed)
+        {
+            return;
+        }
+    }
+
+    /* Wrong, or too old to check: start over from the server and replay what it hasn't played yet */
+    Vector2 predicted = mSelf.position;
+    mSelf.position = state.position;
+    auto [older, newer] = mPredicted.spans();
+    for (std::span<Prediction> run : {older, newer})
+    {
+        for (Prediction &prediction : run)
+        {
+            ApplyInput(&mSelf.position, prediction.input, mSelf.radius);
+            prediction.position = mSelf.position;
+        }
+    }
+
+    mStats.replayedInputs += mPredicted.size();
+    if (predicted != mSelf.position)
+    {
+        mStats.mispredictions++;
+    }
+}
+
+void Client::AcknowledgeInputs(uint64_t processedInputs)
+{
+    if (processedInputs > mProcessedInputs)
+    {
+        mProcessedInputs = processedInputs;
+        while (!mUnacked.empty() && mUnacked.front().sequenceNum < mProcessedInputs)
+        {
+            mUnacked.pop();
+        }
+    }
+}
+
+void Client::ReceiveLockstepFrames(char *buffer, int bytesRead)
+{
+    const size_t headerBytes = SchemaOf<LockstepFramesPacket>::Type::bytes;
+    LockstepFramesPacket data;
+    if (bytesRead < (int)headerBytes || !Decode(buffer, bytesRead, data))
+    {
+        return;
+    }
+
+    AcknowledgeInputs(data.processedInputs);
+    if (!mHasWorld)
+    {
+        SendFrameAck();
+        return;
+    }
+
+    /* Frames already buffered are skipped, a gap means an earlier datagram went missing and is resent */
+    uint32_t next = mWorld.Frame() + mFrames.size();
+    BitReader reader(buffer + headerBytes, bytesRead - headerBytes);
+    for (uint32_t frame = data.firstFrame; frame < data.firstFrame + data.frameCount && frame <= next; frame++)
+    {
+        LockstepFrame decoded;
+        ReadLockstepFrame(reader, decoded);
+        if (!reader.Ok())
+        {
+            break;
+        }
+        if (frame == next)
+        {
+            mFrames.push_back(std::move(decoded));
+            next++;
+        }
+    }
+
+    if (data.newestFrame >= mWorld.Frame() && (mAnchors.empty() || data.newestFrame > mAnchors.back().frame))
+    {
+        mAnchors.push({.frame = data.newestFrame, .processedInputs = data.processedInputs});
+    }
+    SendFrameAck();
+}
+
+void Client::ReceiveLockstepWorld(char *buffer, int bytesRead)
+{
+    LockstepStatePacket data;
+    BitReader reader(buffer, bytesRead);
+    SchemaOf<LockstepStatePacket>::Type::Read(reader, data);
+    if (!reader.Ok())
     {
-        auto data = reinterpret_cast<DotUpdatePacket *>(buffer);
+        return;
+    }
+
+    /* Sent again every tick until our ack gets through */
+    if (mHasWorld)
+    {
+        SendFrameAck();
+        return;
+    }
+
+    if (!mPendingWorld.active || data.frame != mPendingWorld.frame)
+    {
+        if (mPendingWorld.active && data.frame < mPendingWorld.frame)
         {
-            for (int i = 0; i < DOT_COUNT; i++)
+            return;
+        }
+
+        mPendingWorld.active = true;
+        mPendingWorld.frame = data.frame;
+        mPendingWorld.random = data.random;
+        memcpy(mPendingWorld.dots, data.dots, sizeof(data.dots));
+        mPendingWorld.fragments.assign(data.fragmentCount, {});
+        mPendingWorld.received.assign(data.fragmentCount, false);
+        mPendingWorld.remaining = data.fragmentCount;
+    }
+
+    if (data.fragmentIndex >= mPendingWorld.received.size() || mPendingWorld.received[data.fragmentIndex])
+    {
+        return;
+    }
+
+    std::vector<LockstepPlayer> &players = mPendingWorld.fragments[data.fragmentIndex];
+    players.resize(data.playerCount);
+    for (LockstepPlayer &player : players)
+    {
+        SchemaOf<LockstepPlayer>::Type::Read(reader, player);
+    }
+    if (!reader.Ok())
+    {
+        players.clear();
+        return;
+    }
+
+    mPendingWorld.received[data.fragmentIndex] = true;
+    if (--mPendingWorld.remaining > 0)
+    {
+        return;
+    }
+
+    std::vector<LockstepPlayer> world;
+    for (const auto &fragment : mPendingWorld.fragments)
+    {
+        world.insert(world.end(), fragment.begin(), fragment.end());
+    }
+    mWorld.SetState(mPendingWorld.frame, mPendingWorld.random, mPendingWorld.dots, std::move(world));
+    mPendingWorld.active = false;
+    mHasWorld = true;
+    mFrames.clear();
+    mAnchors.clear();
+    mAnchored = false;
+    SendFrameAck();
+}
+
+void Client::SendFrameAck()
+{
+    FrameAckPacket ack;
+    ack.nextFrame = mHasWorld ? mWorld.Frame() + (uint32_t)mFrames.size() : NO_FRAME;
+    auto encoded = Encode(ack);
+    mSock.SendTo(encoded.data, encoded.size, mServerAddr);
+    mStats.packetsSent++;
+}
+
+/*
+ * Frames arrive a tick's worth at a time and are played one per input frame, so remote players move
+ * smoothly. A backlog past the playout target is played at once rather than adding latency.
+ */
+void Client::PlayLockstepFrames()
+{
+    if (!mHasWorld)
+    {
+        return;
+    }
+
+    size_t count = std::min<size_t>(mFrames.size(), 1);
+    if (mFrames.size() > LOCKSTEP_PLAYOUT_FRAMES)
+    {
+        count = mFrames.size() - LOCKSTEP_PLAYOUT_FRAMES + 1;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const LockstepFrame &frame = mFrames.front();
+        if (!mWorld.Apply(frame) || mWorld.Checksum() != frame.checksum)
+        {
+            /* Out of step with the server, nothing to do but start over from its world */
+            mStats.desyncs++;
+            mHasWorld = false;
+            mFrames.clear();
+            mAnchors.clear();
+            mAnchored = false;
+            SendFrameAck();
+            return;
+        }
+        mFrames.pop_front();
+        mStats.lockstepFrames++;
+
+        while (!mAnchors.empty() && mAnchors.front().frame < mWorld.Frame())
+        {
+            mAnchors.pop();
+        }
+
+        const LockstepPlayer *self = mWorld.Find(mPort);
+        if (self == nullptr || mAnchors.empty() || mAnchors.front().frame != mWorld.Frame())
+        {
+            continue;
+        }
+
+        Vector2 predicted = PredictLockstep();
+        mAnchored = true;
+        mAnchorInputs = mAnchors.pop().processedInputs;
+        mAnchorX = self->x;
+        mAnchorY = self->y;
+        while (!mPredicted.empty() && mPredicted.front().sequenceNum < mAnchorInputs)
+        {
+            mPredicted.pop();
+        }
+
+        mStats.reconciliations++;
+        mStats.replayedInputs += mPredicted.size();
+        if (PredictLockstep() != predicted)
+        {
+            mStats.mispredictions++;
+        }
+    }
+
+    /* Until the first anchor we are wherever the world has us */
+    const LockstepPlayer *self = mWorld.Find(mPort);
+    if (self)
+    {
+        mSelf.radius = self->radius;
+        mSelf.position = mAnchored ? PredictLockstep() : Vector2{FixedToFloat(self->x), FixedToFloat(self->y)};
+    }
+}
+
+/* From the anchor, every input the server hadn't played by then, in fixed point like the world */
+Vector2 Client::PredictLockstep() const
+{
+    Fixed x = mAnchorX, y = mAnchorY;
+    auto [older, newer] = mPredicted.spans();
+    for (std::span<const Prediction> run : {older, newer})
+    {
+        for (const Prediction &prediction : run)
+        {
+            if (prediction.sequenceNum >= mAnchorInputs)
             {
-                mDots[i] = data->positions[i];
+                LockstepWorld::Move(x, y, prediction.input, mSelf.radius);
             }
         }
-        break;
     }
+    return {FixedToFloat(x), FixedToFloat(y)};
+}
 
-    default:
-        break;
+void Client::SetHeadless(std::function<uint8_t(uint64_t sequence)> source)
+{
+    mHeadless = true;
+    mInputSource = std::move(source);
+
+    if (!mInputSource)
+    {
+        /* Holds a random direction for 20 to 100 frames, like someone steering with the arrow keys */
+        mInputSource = [random = std::minstd_rand(mPort), input = (uint8_t)0, until = (uint64_t)0](uint64_t sequence) mutable
+        {
+            if (sequence >= until)
+            {
+                input = (uint8_t)(random() & 0x0f);
+                until = sequence + 20 + random() % 80;
+            }
+            return input;
+        };
     }
 }
 
@@ -124,45 +593,146 @@ void Client::Run()
         return;
     }
 
-    PacketHeader connectPacket = {.type = MSG::CONNECT};
-    mSock.SendTo(&connectPacket, sizeof(PacketHeader), mServerAddr);
+    auto connectPacket = Encode(PacketHeader{.type = MSG::CONNECT});
+    mSock.SendTo(connectPacket.data, connectPacket.size, mServerAddr);
 
-    InitWindow(WORLD_WIDTH, WORLD_HEIGHT, "Multiplayer");
-    SetTargetFPS(100);
+    if (mHeadless)
+    {
+        /* No window to close, Ctrl-C ends it and still says goodbye to the server */
+        Shutdown::setup();
+        using namespace std::chrono;
+        auto next = steady_clock::now();
+        while (mRunning && !Shutdown::should_shutdown())
+        {
+            Frame();
+            next += milliseconds(10);
+            std::this_thread::sleep_until(next);
+        }
+    }
+    else
+    {
+        InitWindow(WORLD_WIDTH, WORLD_HEIGHT, "Multiplayer");
+        SetTargetFPS(100);
 
-    PlayerUpdatePacket packet;
+        while (mRunning && !WindowShouldClose())
+        {
+            Frame();
+            Render();
+        }
+    }
 
-    while (mRunning && !WindowShouldClose())
-    {
+    Disconnect();
+    mLoop.Stop();
+    mSock.Close();
+}
+
+void Client::Frame()
+{
+    double now = LocalTime();
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        mServerTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-                          currentTime - mStartTime)
-                          .count();
+    uint8_t input = mHeadless ? mInputSource(mSequenceNumber) : EncodeInput();
 
-        Render();
+    mUpdate.entry.input[mSequenceNumber % INPUT_BUFFER_SIZE] = input;
 
-        uint8_t input = EncodeInput();
+    std::lock_guard<std::mutex> lock(mMutex);
 
-        packet.entry.input[mSequenceNumber % INPUT_BUFFER_SIZE] = input;
+    /* Quickly until the estimate has something to go on, then often enough to follow drift */
+    if (now >= mNextPing)
+    {
+        SendPing(now);
+        mNextPing = now + (mClock.GetStats().samples < 8 ? 100.0 : 1000.0);
+    }
+    mServerTime = mClock.ServerTime(now);
+    mRenderDelay += (mDelay.Delay() - mRenderDelay) * 0.05f;
 
-        mMutex.lock();
-        mPredicted.push({mSequenceNumber, input});
+    if (mLockstep)
+    {
+        mPredicted.push({mSequenceNumber, input, mSelf.position});
+        PlayLockstepFrames();
+    }
+    else
+    {
         ApplyInput(&mSelf.position, input, mSelf.radius);
-        mMutex.unlock();
+        mPredicted.push({mSequenceNumber, input, mSelf.position});
+    }
+
+    if (mWindowEvery > 0)
+    {
+        /* Older inputs fall off a full window, the server gives up on those once it has waited long enough */
+        mUnacked.push({mSequenceNumber, input});
 
-        if (mSequenceNumber % INPUT_BUFFER_SIZE == 0)
+        if (mSequenceNumber % mWindowEvery == 0)
         {
-            packet.entry.sequenceNum = mSequenceNumber;
-            mSock.SendTo(&packet, sizeof(PlayerUpdatePacket), mServerAddr);
-            mLastSent = mSequenceNumber;
+            uint8_t inputs[INPUT_WINDOW_SIZE];
+            for (size_t i = 0; i < mUnacked.size(); i++)
+            {
+                inputs[i] = mUnacked.at(i).input;
+            }
+
+            char buffer[MAX_DATAGRAM_SIZE];
+            size_t size = EncodeInputWindow(buffer, sizeof(buffer), mUnacked.front().sequenceNum, inputs, mUnacked.size());
+            mSock.SendTo(buffer, size, mServerAddr);
+            mStats.packetsSent++;
         }
-        mSequenceNumber++;
     }
+    else if (mSequenceNumber % INPUT_BUFFER_SIZE == 0)
+    {
+        mUpdate.entry.sequenceNum = mSequenceNumber;
+        auto encoded = Encode(mUpdate);
+        mSock.SendTo(encoded.data, encoded.size, mServerAddr);
+        mStats.packetsSent++;
+    }
+    mSequenceNumber++;
+}
 
-    PacketHeader disconnect = {.type = MSG::DISCONNECT};
-    mSock.SendTo(&disconnect, sizeof(PacketHeader), mServerAddr);
-    mSock.Close();
+double Client::LocalTime() const
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mClockStart).count();
+}
+
+void Client::SendPing(double now)
+{
+    TimePingPacket ping;
+    ping.clientSend = (uint64_t)(now * 1000.0);
+    auto encoded = Encode(ping);
+    mSock.SendTo(encoded.data, encoded.size, mServerAddr);
+    mStats.packetsSent++;
+}
+
+void Client::SetLockstep(bool lockstep)
+{
+    mLockstep = lockstep;
+}
+
+void Client::SetExtrapolationLimit(float ms)
+{
+    mExtrapolationLimit = std::max(ms, 0.0f);
+}
+
+void Client::SetInputWindow(int frames)
+{
+    mWindowEvery = std::max(frames, 0);
+}
+
+void Client::Disconnect()
+{
+    auto disconnect = Encode(PacketHeader{.type = MSG::DISCONNECT});
+    mSock.SendTo(disconnect.data, disconnect.size, mServerAddr);
+    mRunning = false;
+}
+
+bool Client::IsRunning() const
+{
+    return mRunning;
+}
+
+Client::Stats Client::GetStats()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    Stats stats = mStats;
+    stats.rttMs = mClock.RoundTrip();
+    stats.renderDelayMs = mRenderDelay;
+    return stats;
 }
 
 void Client::Render()
@@ -184,19 +754,38 @@ void Client::Render()
     DrawGrid(100, 50);
     rlPopMatrix();
 
-    float renderTime = mServerTime - 200;
+    double renderTime = mServerTime - mRenderDelay;
     mMutex.lock();
-    for (int i = 0; i < DOT_COUNT; i++)
+    if (mLockstep)
     {
-        DrawCircle(mDots[i].x, mDots[i].y, DOT_RADIUS, GREEN);
+        /* Everyone else as of the last frame played, it is already paced */
+        for (int i = 0; i < DOT_COUNT; i++)
+        {
+            DrawCircle(FixedToFloat(mWorld.Dots()[i].x), FixedToFloat(mWorld.Dots()[i].y), DOT_RADIUS, GREEN);
+        }
+        for (const LockstepPlayer &player : mWorld.Players())
+        {
+            if (player.id != mPort)
+            {
+                DrawCircle(FixedToFloat(player.x), FixedToFloat(player.y), player.radius, BLUE);
+            }
+        }
+        DrawCircle(mSelf.position.x, mSelf.position.y, mSelf.radius, RED);
     }
+    else
+    {
+        for (int i = 0; i < DOT_COUNT; i++)
+        {
+            DrawCircle(mDots[i].x, mDots[i].y, DOT_RADIUS, GREEN);
+        }
 
-    DrawCircle(mSelf.position.x, mSelf.position.y, mSelf.radius, RED);
+        DrawCircle(mSelf.position.x, mSelf.position.y, mSelf.radius, RED);
 
-    for (auto &[id, player] : mPlayers)
-    {
-        Vector2 position = GetInterpolatedPosition(player, renderTime);
-        DrawCircle(position.x, position.y, player.radius, mPort == id ? RED : BLUE);
+        for (auto &[id, player] : mPlayers)
+        {
+            Vector2 position = GetInterpolatedPosition(player, renderTime);
+            DrawCircle(position.x, position.y, player.radius, mPort == id ? RED : BLUE);
+        }
     }
 
     mMutex.unlock();
@@ -204,43 +793,70 @@ void Client::Render()
     EndDrawing();
 }
 
-Vector2 Client::GetInterpolatedPosition(Player &player, float renderTime)
+Vector2 Client::GetInterpolatedPosition(Player &player, double renderTime)
 {
-    // Find the two snapshots that bracket the target time
-    Position *before = nullptr;
-    Position *after = nullptr;
+    const auto &history = player.positions;
+    if (history.empty())
+    {
+        return {0, 0};
+    }
 
-    int size = player.positions.size();
-    auto &positionHistory = player.positions;
+    /*
+     * Render time only creeps forward, so the cursor moves a step or two a frame rather than the
+     * history being searched. It steps back only when the render delay grows
+     */
+    const uint64_t first = player.pushed - history.size();
+    player.cursor = std::max(player.cursor, first);
+    while (player.cursor > first && history[player.cursor - first].time > renderTime)
+    {
+        player.cursor--;
+    }
+    while (player.cursor + 1 < player.pushed && history[player.cursor + 1 - first].time <= renderTime)
+    {
+        player.cursor++;
+    }
 
-    for (int i = 0; i < size - 1; i++)
+    const Position &before = history[player.cursor - first];
+    if (before.time > renderTime)
     {
-        if (positionHistory.at(i).time <= renderTime &&
-            positionHistory.at(i + 1).time >= renderTime)
-        {
-            before = &positionHistory.at(i);
-            after = &positionHistory.at(i + 1);
-            break;
-        }
+        mStats.beforeHistory++;
+        return before.position;
     }
 
-    if (!before || !after)
+    if (player.cursor + 1 < player.pushed)
     {
-        if (!positionHistory.size())
-        {
-            return {0, 0};
-        }
-        /* If for whatever reason, our render time is outside of the buffered positions*/
-        std::cout << "time: " << renderTime << ", latest: " << positionHistory.back().time << ", last: " << positionHistory.front().time << '\n';
-        return positionHistory.back().position;
+        const Position &after = history[player.cursor + 1 - first];
+        float t = (float)((renderTime - before.time) / (after.time - before.time));
+        return Vector2{
+            Lerp(before.position.x, after.position.x, t),
+            Lerp(before.position.y, after.position.y, t)};
+    }
+
+    /*
+     * Past the newest snapshot: carry on at the last velocity for a while, then hold. Without two
+     * distinct stamps there is no velocity to carry on at, the player just holds and that is not capping
+     */
+    if (history.size() < 2 || before.time <= history[history.size() - 2].time)
+    {
+        return before.position;
     }
 
-    float t = static_cast<float>(renderTime - before->time) /
-              static_cast<float>(after->time - before->time);
+    const Position &previous = history[history.size() - 2];
+    double ahead = renderTime - before.time;
+    if (ahead > mExtrapolationLimit)
+    {
+        ahead = mExtrapolationLimit;
+        mStats.extrapolationCapped++;
+    }
+    else
+    {
+        mStats.extrapolated++;
+    }
 
+    float t = (float)(ahead / (before.time - previous.time));
     return Vector2{
-        Lerp(before->position.x, after->position.x, t),
-        Lerp(before->position.y, after->position.y, t)};
+        before.position.x + (before.position.x - previous.position.x) * t,
+        before.position.y + (before.position.y - previous.position.y) * t};
 }
 
 uint8_t Client::EncodeInput()
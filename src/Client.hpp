@@ -2,11 +2,18 @@
 #include "UdpSocket.hpp"
 #include "Shutdown.hpp"
 #include "Shared.hpp"
+#include "EventLoop.hpp"
+#include "ClockSync.hpp"
+#include "Lockstep.hpp"
 #include "rlgl.h"
 #include <map>
+#include <deque>
+#include <random>
 
 class Client
 {
+    /* bin bench times interpolation on its own */
+    friend struct BenchAccess;
 
     struct Self
     {
@@ -20,27 +27,177 @@ class Client
         uint8_t input;
     };
 
+    /* An input applied locally and where it left us, kept until the server says it played it too */
+    struct Prediction
+    {
+        uint64_t sequenceNum;
+        uint8_t input;
+        Vector2 position;
+    };
+
+    /* A fully received world snapshot, a possible baseline for the server's next deltas */
+    struct ClientSnapshot
+    {
+        uint32_t id{NO_BASELINE};
+        std::map<int, PlayerState> players;
+    };
+
+    /* The snapshot whose fragments are still arriving, built on a copy of its baseline */
+    struct PendingSnapshot
+    {
+        bool active{false};
+        uint32_t id{0};
+        double time{0};
+        /* Our inputs the server had played when it took the snapshot */
+        uint64_t processedInputs{0};
+        std::map<int, PlayerState> players;
+        std::vector<bool> received;
+        int remaining{0};
+    };
+
+    /* The server's world had reached frame having played processedInputs of our inputs */
+    struct Anchor
+    {
+        uint32_t frame;
+        uint64_t processedInputs;
+    };
+
+    /* A lockstep world whose fragments are still arriving */
+    struct PendingWorld
+    {
+        bool active{false};
+        uint32_t frame{0};
+        uint64_t random{0};
+        FixedPoint dots[DOT_COUNT];
+        std::vector<std::vector<LockstepPlayer>> fragments;
+        std::vector<bool> received;
+        int remaining{0};
+    };
+
+public:
+    struct Stats
+    {
+        uint64_t packetsSent;
+        uint64_t packetsReceived;
+        uint64_t snapshots;
+        uint64_t dotUpdates;
+        /* Snapshots that held our own player, and how many disagreed with the prediction */
+        uint64_t reconciliations;
+        uint64_t mispredictions;
+        /* Inputs simulated again to correct those mispredictions */
+        uint64_t replayedInputs;
+        /* From the server stamping a snapshot to it completing here, on the synchronized clock */
+        uint64_t latencySamples;
+        double latencySumMs;
+        double latencyMaxMs;
+        /* Remote players drawn past their newest snapshot, and those held at the limit */
+        uint64_t extrapolated;
+        uint64_t extrapolationCapped;
+        /* Drawn at their oldest position, the render time was earlier than the whole history */
+        uint64_t beforeHistory;
+        /* Lockstep frames played, and how often the world came out different from the server's */
+        uint64_t lockstepFrames;
+        uint64_t desyncs;
+        /* Current, not cumulative */
+        double rttMs;
+        double renderDelayMs;
+    };
+
 private:
     UdpSocket mSock;
+    EventLoop mLoop;
     Self mSelf;
-    uint64_t mLastSent{0};
-    CircularBuffer<Input> mPredicted{20};
+    /* Bounded like the input window, the server gives up on inputs older than that anyway */
+    CircularBuffer<Prediction, INPUT_WINDOW_SIZE> mPredicted;
     int mPort;
     sockaddr_in mServerAddr;
-    bool mRunning{false};
-    float mServerTime{0};
-    std::chrono::high_resolution_clock::time_point mStartTime;
+    std::atomic<bool> mRunning{false};
+    /* No window: inputs come from mInputSource and Run() paces frames itself */
+    bool mHeadless{false};
+    std::function<uint8_t(uint64_t sequence)> mInputSource;
+    PlayerUpdatePacket mUpdate;
+    /* Frames between input windows, 0 to send an entry every INPUT_BUFFER_SIZE frames instead */
+    int mWindowEvery{0};
+    /* Inputs the server hasn't played yet, resent in every window until a snapshot says it has */
+    CircularBuffer<Input> mUnacked{INPUT_WINDOW_SIZE};
+    uint64_t mProcessedInputs{0};
+    Stats mStats{};
+    /* Our own clock, the server's is estimated from it */
+    std::chrono::steady_clock::time_point mClockStart{std::chrono::steady_clock::now()};
+    ClockSync mClock;
+    double mNextPing{0.0};
+    double mServerTime{0};
+    /* Remote players are drawn this far in the past, easing towards what the snapshot timing asks for */
+    InterpolationDelay mDelay;
+    float mRenderDelay{200.0f};
+    /* How far past the newest snapshot remote players are extrapolated before they stop */
+    float mExtrapolationLimit{100.0f};
     uint64_t mSequenceNumber{0};
+    uint32_t mSnapshotId{0};
+    bool mHasSnapshot{false};
+    PendingSnapshot mPending;
+    CircularBuffer<ClientSnapshot> mSnapshots;
     Vector2 mDots[DOT_COUNT];
     std::map<int, Player> mPlayers;
+    /*
+     * Lockstep: the world is simulated here from the server's frames, played one per input frame.
+     * Our own player is drawn from the last anchor with the inputs the server hadn't played by then
+     * replayed on top, the same rollback Reconcile() does with snapshots.
+     */
+    bool mLockstep{false};
+    LockstepWorld mWorld;
+    bool mHasWorld{false};
+    PendingWorld mPendingWorld;
+    std::deque<LockstepFrame> mFrames;
+    CircularBuffer<Anchor> mAnchors{8};
+    bool mAnchored{false};
+    uint64_t mAnchorInputs{0};
+    Fixed mAnchorX{0};
+    Fixed mAnchorY{0};
     std::mutex mMutex;
     void ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender);
+    void ReceiveSnapshotFragment(char *buffer, int bytesRead);
+    void CompleteSnapshot();
+    void Reconcile(const PlayerState &state, uint64_t processedInputs);
+    void AcknowledgeInputs(uint64_t processedInputs);
+    void ReceiveLockstepFrames(char *buffer, int bytesRead);
+    void ReceiveLockstepWorld(char *buffer, int bytesRead);
+    void SendFrameAck();
+    void PlayLockstepFrames();
+    Vector2 PredictLockstep() const;
     void Render();
     uint8_t EncodeInput();
-    Vector2 GetInterpolatedPosition(Player &player, float renderTime);
+    double LocalTime() const;
+    void SendPing(double now);
+    bool CreateSocket();
+    Vector2 GetInterpolatedPosition(Player &player, double renderTime);
 
 public:
-    Client(int port, int serverPort);
-    void Attach();
+    /* snapshotHistory bounds the baselines kept for the server's deltas, bots can get by with a few */
+    Client(int port, int serverPort, size_t snapshotHistory = 32);
+    void Attach(NetBackend backend = NetBackend::Thread);
+
+    /* Receives on a loop someone else runs, so many clients can share one thread. Before the loop starts */
+    void Attach(EventLoop &loop);
+
+    /* Runs without a window or keyboard, inputs come from source. Random ones if it's empty */
+    void SetHeadless(std::function<uint8_t(uint64_t sequence)> source);
+
+    /* Sends every unacknowledged input each frames frames, so a lost datagram costs nothing but latency */
+    void SetInputWindow(int frames);
+
+    /* Runs the server's lockstep frames instead of following snapshots, needs a server in lockstep too */
+    void SetLockstep(bool lockstep);
+
+    /* Milliseconds a late snapshot may be extrapolated over, 0 holds players at their last position */
+    void SetExtrapolationLimit(float ms);
+
     void Run();
+
+    /* One frame of input: sample, predict, and send if this frame is due. Run() calls it at 100 FPS */
+    void Frame();
+
+    void Disconnect();
+    bool IsRunning() const;
+    Stats GetStats();
 };
\ No newline at end of file
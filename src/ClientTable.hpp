@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <netinet/in.h>
+#include "Shared.hpp"
+
+/*
+ * Clients keyed by endpoint. The (addr, port) pair is packed into one 48 bit key and looked up in an
+ * open addressing table with linear probing, kept at most half full so a lookup is usually one probe.
+ * The clients themselves live densely in insertion order, so iterating them is a linear walk, and
+ * erasing swaps the last client into the hole.
+ *
+ * Dense positions move on erase, slots don't: every client gets a slot index, stored in
+ * ClientInfo::slot, that stays valid until it is erased. Freed slots are reused by later inserts.
+ */
+class ClientTable
+{
+public:
+    struct Entry
+    {
+        sockaddr_in address;
+        ClientInfo client;
+    };
+
+    /* The endpoint packed into 48 bits */
+    static uint64_t Key(const sockaddr_in &address)
+    {
+        return ((uint64_t)address.sin_addr.s_addr << 16) | address.sin_port;
+    }
+
+private:
+    static constexpr uint32_t mEmpty = UINT32_MAX;
+
+    struct Bucket
+    {
+        uint64_t key;
+        uint32_t dense{mEmpty};
+    };
+
+    std::vector<Bucket> mBuckets;
+    size_t mMask{0};
+    std::vector<Entry> mEntries;
+    std::vector<uint32_t> mDenseToSlot;
+    std::vector<uint32_t> mSlotToDense;
+    std::vector<uint32_t> mFreeSlots;
+
+    size_t Home(uint64_t key) const
+    {
+        return (key * 0x9E3779B97F4A7C15ull >> 32) & mMask;
+    }
+
+    /* The bucket holding key, or the empty bucket where it would go */
+    size_t Probe(uint64_t key) const
+    {
+        size_t i = Home(key);
+        while (mBuckets[i].dense != mEmpty && mBuckets[i].key != key)
+        {
+            i = (i + 1) & mMask;
+        }
+        return i;
+    }
+
+    void Rehash(size_t bucketCount)
+    {
+        mBuckets.assign(bucketCount, Bucket{});
+        mMask = bucketCount - 1;
+
+        for (size_t i = 0; i < mEntries.size(); i++)
+        {
+            uint64_t key = Key(mEntries[i].address);
+            mBuckets[Probe(key)] = {key, (uint32_t)i};
+        }
+    }
+
+    /* Backward shift deletion, no tombstones */
+    void EraseBucket(size_t hole)
+    {
+        size_t i = hole;
+        for (;;)
+        {
+            i = (i + 1) & mMask;
+            if (mBuckets[i].dense == mEmpty)
+            {
+                break;
+            }
+
+            /* An entry can fill the hole if the hole lies between its home and where it sits now */
+            size_t home = Home(mBuckets[i].key);
+            if (((i - home) & mMask) >= ((i - hole) & mMask))
+            {
+                mBuckets[hole] = mBuckets[i];
+                hole = i;
+            }
+        }
+        mBuckets[hole].dense = mEmpty;
+    }
+
+public:
+    explicit ClientTable(size_t capacity = 64)
+    {
+        size_t bucketCount = 16;
+        while (bucketCount < capacity * 2)
+        {
+            bucketCount *= 2;
+        }
+        Rehash(bucketCount);
+    }
+
+    ClientInfo *Find(const sockaddr_in &address)
+    {
+        const Bucket &bucket = mBuckets[Probe(Key(address))];
+        return bucket.dense == mEmpty ? nullptr : &mEntries[bucket.dense].client;
+    }
+
+    /* Returns the existing client if the endpoint is already present */
+    ClientInfo &Insert(const sockaddr_in &address, ClientInfo client)
+    {
+        if ((mEntries.size() + 1) * 2 > mBuckets.size())
+        {
+            Rehash(mBuckets.size() * 2);
+        }
+
+        uint64_t key = Key(address);
+        size_t i = Probe(key);
+        if (mBuckets[i].dense != mEmpty)
+        {
+            return mEntries[mBuckets[i].dense].client;
+        }
+
+        uint32_t slot;
+        if (!mFreeSlots.empty())
+        {
+            slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        }
+        else
+        {
+            slot = mSlotToDense.size();
+            mSlotToDense.push_back(mEmpty);
+        }
+
+        uint32_t dense = mEntries.size();
+        mBuckets[i] = {key, dense};
+        client.slot = slot;
+        mEntries.push_back({address, std::move(client)});
+        mDenseToSlot.push_back(slot);
+        mSlotToDense[slot] = dense;
+        return mEntries.back().client;
+    }
+
+    bool Erase(const sockaddr_in &address)
+    {
+        size_t i = Probe(Key(address));
+        if (mBuckets[i].dense == mEmpty)
+        {
+            return false;
+        }
+
+        EraseAt(mBuckets[i].dense);
+        return true;
+    }
+
+    /* Erases the client at a dense position, the last client moves into it */
+    void EraseAt(size_t dense)
+    {
+        EraseBucket(Probe(Key(mEntries[dense].address)));
+
+        mFreeSlots.push_back(mDenseToSlot[dense]);
+        mSlotToDense[mDenseToSlot[dense]] = mEmpty;
+
+        size_t last = mEntries.size() - 1;
+        if (dense != last)
+        {
+            mEntries[dense] = std::move(mEntries[last]);
+            mDenseToSlot[dense] = mDenseToSlot[last];
+            mSlotToDense[mDenseToSlot[dense]] = dense;
+            mBuckets[Probe(Key(mEntries[dense].address))].dense = dense;
+        }
+
+        mEntries.pop_back();
+        mDenseToSlot.pop_back();
+    }
+
+    /* Stable for as long as the client is present */
+    uint32_t SlotOf(size_t dense) const
+    {
+        return mDenseToSlot[dense];
+    }
+
+    /* Only meaningful for a slot in use */
+    size_t DenseOf(uint32_t slot) const
+    {
+        return mSlotToDense[slot];
+    }
+
+    /* nullptr if the slot is free */
+    Entry *AtSlot(uint32_t slot)
+    {
+        if (slot >= mSlotToDense.size() || mSlotToDense[slot] == mEmpty)
+        {
+            return nullptr;
+        }
+        return &mEntries[mSlotToDense[slot]];
+    }
+
+    /* Upper bound on slot indices, for sizing per slot arrays */
+    size_t SlotCapacity() const
+    {
+        return mSlotToDense.size();
+    }
+
+    Entry &at(size_t dense)
+    {
+        return mEntries[dense];
+    }
+
+    size_t size() const
+    {
+        return mEntries.size();
+    }
+
+    bool empty() const
+    {
+        return mEntries.empty();
+    }
+
+    std::vector<Entry>::iterator begin()
+    {
+        return mEntries.begin();
+    }
+
+    std::vector<Entry>::iterator end()
+    {
+        return mEntries.end();
+    }
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "CircularBuffer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Estimates the server's clock from ping/pong exchanges, NTP style. Each exchange gives four
+ * timestamps: client send, server receive, server send and client receive. Their round trip less the
+ * server's hold time is the RTT, and the offset assumes both legs took half of it.
+ *
+ * A sample delayed on one leg only skews its offset by up to half its extra RTT, so only samples
+ * within a margin of the window's smallest RTT are trusted. Offset and drift are a least squares line
+ * through those, which keeps the estimate moving smoothly between pings rather than stepping.
+ */
+class ClockSync
+{
+public:
+    struct Stats
+    {
+        uint64_t samples;
+        /* Queued somewhere on the way, not used for the estimate */
+        uint64_t rejected;
+        double offsetMs;
+        double driftPpm;
+        double rttMs;
+    };
+
+private:
+    struct Sample
+    {
+        double time;
+        double offset;
+        double rtt;
+    };
+
+    /* Beyond this a drifting clock has moved and the line through the samples is what matters */
+    static constexpr size_t windowSize = 32;
+    static constexpr double maxDrift = 500e-6;
+
+    CircularBuffer<Sample> mSamples{windowSize};
+    double mOffset{0.0};
+    double mDrift{0.0};
+    double mReference{0.0};
+    double mRtt{0.0};
+    bool mSynced{false};
+    uint64_t mTotal{0};
+    uint64_t mRejected{0};
+
+    double MinRtt() const
+    {
+        double best = mSamples.at(0).rtt;
+        for (size_t i = 1; i < mSamples.size(); i++)
+        {
+            best = std::min(best, mSamples.at(i).rtt);
+        }
+        return best;
+    }
+
+    /* A millisecond of slack keeps a fast, quiet link from rejecting nearly everything */
+    bool Trusted(const Sample &sample, double minRtt) const
+    {
+        return sample.rtt <= minRtt * 1.5 + 1.0;
+    }
+
+    void Refit()
+    {
+        double minRtt = MinRtt();
+        double n = 0, meanTime = 0, meanOffset = 0;
+        for (size_t i = 0; i < mSamples.size(); i++)
+        {
+            const Sample &sample = mSamples.at(i);
+            if (Trusted(sample, minRtt))
+            {
+                n++;
+                meanTime += sample.time;
+                meanOffset += sample.offset;
+            }
+        }
+        meanTime /= n;
+        meanOffset /= n;
+
+        double covariance = 0, variance = 0;
+        for (size_t i = 0; i < mSamples.size(); i++)
+        {
+            const Sample &sample = mSamples.at(i);
+            if (Trusted(sample, minRtt))
+            {
+                covariance += (sample.time - meanTime) * (sample.offset - meanOffset);
+                variance += (sample.time - meanTime) * (sample.time - meanTime);
+            }
+        }
+
+        /* Drift needs a few seconds of samples to stand out from the noise */
+        const double minSpanSquared = 1000.0 * 1000.0;
+        mDrift = n >= 4 && variance > minSpanSquared ? std::clamp(covariance / variance, -maxDrift, maxDrift) : 0.0;
+        mReference = meanTime;
+        mOffset = meanOffset;
+        mRtt = minRtt;
+    }
+
+public:
+    /*
+     * Timestamps in milliseconds, the client's on its own clock and the server's on the server's.
+     * Returns false if the sample was too slow to be trusted
+     */
+    bool AddSample(double clientSend, double serverReceive, double serverSend, double clientReceive)
+    {
+        Sample sample{.time = (clientSend + clientReceive) / 2,
+                      .offset = ((serverReceive - clientSend) + (serverSend - clientReceive)) / 2,
+                      .rtt = std::max((clientReceive - clientSend) - (serverSend - serverReceive), 0.0)};
+
+        mTotal++;
+        mSamples.push(sample);
+        if (!Trusted(sample, MinRtt()))
+        {
+            mRejected++;
+            return false;
+        }
+
+        Refit();
+        mSynced = true;
+        return true;
+    }
+
+    bool Synced() const
+    {
+        return mSynced;
+    }
+
+    /* The server's clock when the client's reads clientTime */
+    double ServerTime(double clientTime) const
+    {
+        return clientTime + mOffset + mDrift * (clientTime - mReference);
+    }
+
+    /* Smallest recent round trip, the link's latency without queueing */
+    double RoundTrip() const
+    {
+        return mRtt;
+    }
+
+    Stats GetStats() const
+    {
+        return {.samples = mTotal, .rejected = mRejected, .offsetMs = mOffset, .driftPpm = mDrift * 1e6, .rttMs = mRtt};
+    }
+};
+
+/*
+ * How far behind the server's clock to render remote players. A snapshot's age on arrival, the
+ * estimated server time less its stamp, is the one-way delay plus queueing. Rendering a snapshot
+ * interval plus the usual age plus a few deviations behind keeps the render time between two received
+ * snapshots nearly always, so a steady link is shown little more than a tick behind.
+ */
+class InterpolationDelay
+{
+    double mMinMs;
+    double mMaxMs;
+    double mIntervalMs{100.0};
+    double mAgeMs{0.0};
+    double mDeviationMs{0.0};
+    double mLastStamp{0.0};
+    bool mStarted{false};
+
+public:
+    InterpolationDelay(double minMs = 20.0, double maxMs = 500.0) : mMinMs(minMs), mMaxMs(maxMs)
+    {
+    }
+
+    /* A completed snapshot stamped at stamp, with the server's clock estimated at serverNow */
+    void AddSnapshot(double stamp, double serverNow)
+    {
+        double age = serverNow - stamp;
+        if (!mStarted)
+        {
+            mAgeMs = age;
+            mLastStamp = stamp;
+            mStarted = true;
+            return;
+        }
+
+        /* Gains as in RFC 6298, quick to notice jitter growing and slow to forget it */
+        mDeviationMs += (std::fabs(age - mAgeMs) - mDeviationMs) / 4.0;
+        mAgeMs += (age - mAgeMs) / 8.0;
+        if (stamp > mLastStamp)
+        {
+            mIntervalMs += ((stamp - mLastStamp) - mIntervalMs) / 8.0;
+            mLastStamp = stamp;
+        }
+    }
+
+    double Delay() const
+    {
+        return std::clamp(mIntervalMs + std::max(mAgeMs, 0.0) + 4.0 * mDeviationMs, mMinMs, mMaxMs);
+    }
+};
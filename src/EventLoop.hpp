@@ -0,0 +1,389 @@
+#pragma once
+
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+/*
+ * How a socket gets its datagrams: a dedicated blocking receive thread per socket,
+ * or readiness notifications from an EventLoop that can serve several sockets and
+ * timers from one thread.
+ */
+enum class NetBackend
+{
+    Thread,
+    EventLoop
+};
+
+/*
+ * Single threaded readiness loop. On Linux this is epoll with an eventfd for wakeups
+ * and a timerfd per timer, elsewhere it falls back to poll() with a self pipe and
+ * timers computed from the poll timeout.
+ *
+ * Handlers and timers must be registered before Run()/Start(), and only removed once the
+ * loop has stopped.
+ */
+class EventLoop
+{
+    struct Handler
+    {
+        int fd;
+        std::function<void()> onReadable;
+        bool ownsFd{false};
+        /* Only used by the poll() fallback */
+        std::chrono::steady_clock::time_point deadline{};
+        std::chrono::nanoseconds interval{0};
+    };
+
+private:
+    int mPollFd{-1};
+    int mWakeFds[2]{-1, -1};
+    std::vector<std::unique_ptr<Handler>> mHandlers;
+    std::atomic<bool> mRunning{false};
+    std::thread mThread;
+
+    static void SetNonBlocking(int fd)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    void DrainWake()
+    {
+        uint64_t value;
+        while (read(mWakeFds[0], &value, sizeof(value)) > 0)
+        {
+        }
+    }
+
+    void Loop()
+    {
+        while (mRunning)
+        {
+#ifdef __linux__
+            epoll_event events[32];
+            int count = epoll_wait(mPollFd, events, 32, -1);
+
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                std::cerr << "Error in event loop: " << strerror(errno) << '\n';
+                break;
+            }
+
+            for (int i = 0; i < count && mRunning; i++)
+            {
+                auto handler = static_cast<Handler *>(events[i].data.ptr);
+                if (handler == nullptr)
+                {
+                    DrainWake();
+                    continue;
+                }
+                handler->onReadable();
+            }
+#else
+            std::vector<pollfd> fds;
+            std::vector<Handler *> readers;
+            fds.push_back({mWakeFds[0], POLLIN, 0});
+            auto now = std::chrono::steady_clock::now();
+            int timeout = -1;
+
+            for (auto &handler : mHandlers)
+            {
+                if (handler->fd >= 0)
+                {
+                    fds.push_back({handler->fd, POLLIN, 0});
+                    readers.push_back(handler.get());
+                }
+                else
+                {
+                    auto wait = std::chrono::ceil<std::chrono::milliseconds>(handler->deadline - now).count();
+                    wait = std::max<long long>(wait, 0);
+                    timeout = timeout < 0 ? wait : std::min<long long>(timeout, wait);
+                }
+            }
+
+            int count = poll(fds.data(), fds.size(), timeout);
+            if (count < 0 && errno != EINTR)
+            {
+                std::cerr << "Error in event loop: " << strerror(errno) << '\n';
+                break;
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                DrainWake();
+            }
+
+            for (size_t i = 1; i < fds.size() && mRunning; i++)
+            {
+                if (fds[i].revents & POLLIN)
+                {
+                    readers[i - 1]->onReadable();
+                }
+            }
+
+            now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < mHandlers.size() && mRunning; i++)
+            {
+                if (mHandlers[i]->fd < 0 && mHandlers[i]->deadline <= now)
+                {
+                    mHandlers[i]->onReadable();
+                }
+            }
+#endif
+        }
+    }
+
+public:
+    EventLoop() {}
+    ~EventLoop()
+    {
+        Close();
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    bool Create()
+    {
+        if (mWakeFds[0] >= 0)
+        {
+            return true;
+        }
+
+#ifdef __linux__
+        mPollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (mPollFd < 0)
+        {
+            std::cerr << "Failed to create epoll instance: " << strerror(errno) << '\n';
+            return false;
+        }
+
+        mWakeFds[0] = mWakeFds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (mWakeFds[0] < 0)
+        {
+            std::cerr << "Failed to create eventfd: " << strerror(errno) << '\n';
+            return false;
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(mPollFd, EPOLL_CTL_ADD, mWakeFds[0], &event);
+#else
+        if (pipe(mWakeFds) < 0)
+        {
+            std::cerr << "Failed to create wake pipe: " << strerror(errno) << '\n';
+            return false;
+        }
+        SetNonBlocking(mWakeFds[0]);
+        SetNonBlocking(mWakeFds[1]);
+#endif
+        return true;
+    }
+
+    bool AddReader(int fd, std::function<void()> onReadable)
+    {
+        if (!Create())
+        {
+            return false;
+        }
+
+        auto handler = std::make_unique<Handler>(Handler{.fd = fd, .onReadable = onReadable});
+
+#ifdef __linux__
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = handler.get();
+        if (epoll_ctl(mPollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            std::cerr << "Failed to register fd with epoll: " << strerror(errno) << '\n';
+            return false;
+        }
+#endif
+
+        mHandlers.push_back(std::move(handler));
+        return true;
+    }
+
+    void RemoveReader(int fd)
+    {
+        for (auto it = mHandlers.begin(); it != mHandlers.end(); ++it)
+        {
+            if ((*it)->fd == fd)
+            {
+#ifdef __linux__
+                epoll_ctl(mPollFd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+                mHandlers.erase(it);
+                return;
+            }
+        }
+    }
+
+    /* Periodic timer, the callback receives how many intervals elapsed since it last ran */
+    bool AddTimer(std::chrono::nanoseconds interval, std::function<void(uint64_t expirations)> callback)
+    {
+        if (!Create())
+        {
+            return false;
+        }
+
+#ifdef __linux__
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0)
+        {
+            std::cerr << "Failed to create timerfd: " << strerror(errno) << '\n';
+            return false;
+        }
+
+        itimerspec spec{};
+        spec.it_interval.tv_sec = interval.count() / 1000000000;
+        spec.it_interval.tv_nsec = interval.count() % 1000000000;
+        spec.it_value = spec.it_interval;
+        timerfd_settime(fd, 0, &spec, nullptr);
+
+        if (!AddReader(fd, [fd, callback]()
+                       {
+                           uint64_t expirations = 0;
+                           if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                           {
+                               callback(expirations);
+                           } }))
+        {
+            close(fd);
+            return false;
+        }
+
+        mHandlers.back()->ownsFd = true;
+        return true;
+#else
+        auto handler = std::make_unique<Handler>();
+        handler->fd = -1;
+        handler->interval = interval;
+        handler->deadline = std::chrono::steady_clock::now() + interval;
+        handler->onReadable = [handler = handler.get(), callback]()
+        {
+            auto now = std::chrono::steady_clock::now();
+            uint64_t expirations = 1 + (now - handler->deadline) / handler->interval;
+            handler->deadline += handler->interval * expirations;
+            callback(expirations);
+        };
+        mHandlers.push_back(std::move(handler));
+        return true;
+#endif
+    }
+
+    /* Runs handlers on the calling thread until Stop() */
+    void Run()
+    {
+        if (!Create())
+        {
+            return;
+        }
+
+        mRunning = true;
+        Loop();
+    }
+
+    /* Runs the loop on its own thread */
+    bool Start()
+    {
+        if (!Create())
+        {
+            return false;
+        }
+        if (mThread.joinable())
+        {
+            std::cerr << "Event loop already running\n";
+            return false;
+        }
+
+        mRunning = true;
+        mThread = std::thread(&EventLoop::Loop, this);
+        return true;
+    }
+
+    void Wake()
+    {
+        uint64_t value = 1;
+        if (mWakeFds[1] < 0)
+        {
+            return;
+        }
+
+        ssize_t written;
+        do
+        {
+            written = write(mWakeFds[1], &value, sizeof(value));
+        } while (written < 0 && errno == EINTR);
+
+        /* EAGAIN means the counter or pipe is full, so a wakeup is pending already */
+        if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            std::cerr << "Failed to wake event loop: " << strerror(errno) << '\n';
+        }
+    }
+
+    /* Safe to call from a handler, in which case Run() returns once the handler does */
+    void Stop()
+    {
+        mRunning = false;
+        Wake();
+
+        if (mThread.joinable() && mThread.get_id() != std::this_thread::get_id())
+        {
+            mThread.join();
+        }
+    }
+
+    void Close()
+    {
+        Stop();
+
+        /* Timer fds are owned by the loop, sockets are closed by their owners */
+        for (auto &handler : mHandlers)
+        {
+            if (handler->ownsFd)
+            {
+                close(handler->fd);
+            }
+        }
+        mHandlers.clear();
+
+        if (mWakeFds[1] >= 0 && mWakeFds[1] != mWakeFds[0])
+        {
+            close(mWakeFds[1]);
+        }
+        if (mWakeFds[0] >= 0)
+        {
+            close(mWakeFds[0]);
+        }
+        mWakeFds[0] = mWakeFds[1] = -1;
+
+        if (mPollFd >= 0)
+        {
+            close(mPollFd);
+            mPollFd = -1;
+        }
+    }
+};
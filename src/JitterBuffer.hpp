@@ -0,0 +1,212 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * Fixed-capacity playout buffer for a stream of sequenced items, such as a client's input entries.
+ * Items are stored in a ring indexed by sequence modulo capacity, so inserting, spotting a duplicate
+ * and rejecting a late arrival are all O(1), and nothing allocates after construction.
+ *
+ * Playout holds back until the buffer is targetDepth sequences deep, so an item that arrives a
+ * little late still makes it in time. The target follows the measured arrival jitter (RFC 3550's
+ * interarrival estimate): a steady stream is played as soon as it arrives, a jittery one buys
+ * smoothness with latency.
+ */
+template <typename T>
+class JitterBuffer
+{
+    struct Slot
+    {
+        uint64_t sequence;
+        bool filled{false};
+        T item;
+    };
+
+public:
+    struct Stats
+    {
+        size_t depth;
+        size_t targetDepth;
+        float jitter;
+        /* Arrived after their turn had passed */
+        uint64_t late;
+        uint64_t duplicates;
+        /* Pushed out unplayed by newer items more than a capacity ahead */
+        uint64_t dropped;
+        /* Never arrived, skipped so playout could go on */
+        uint64_t missed;
+    };
+
+private:
+    std::vector<Slot> mSlots;
+    size_t mMask;
+    /* Items are spaced this far apart in arrival time units when nothing is jittering */
+    float mInterval;
+    bool mStarted{false};
+    bool mBuffering{true};
+    /* Next sequence to play out, and one past the newest sequence received */
+    uint64_t mNext{0};
+    uint64_t mEnd{0};
+    size_t mTargetDepth{1};
+
+    uint64_t mLastSequence{0};
+    float mLastArrival{0.0f};
+    float mJitter{0.0f};
+
+    uint64_t mLate{0};
+    uint64_t mDuplicates{0};
+    uint64_t mDropped{0};
+    uint64_t mMissed{0};
+
+    void UpdateJitter(uint64_t sequence, float arrival)
+    {
+        if (mStarted)
+        {
+            float transit = (arrival - mLastArrival) - ((float)sequence - (float)mLastSequence) * mInterval;
+            mJitter += (std::fabs(transit) - mJitter) / 16.0f;
+        }
+        mLastSequence = sequence;
+        mLastArrival = arrival;
+
+        /* Two jitters of headroom catch most arrivals, the extra item absorbs tick phase */
+        size_t target = (size_t)std::ceil(2.0f * mJitter / mInterval) + 1;
+        mTargetDepth = std::min(target, mSlots.size() / 2);
+    }
+
+public:
+    JitterBuffer(size_t capacity, float interval) : mSlots(capacity), mMask(capacity - 1), mInterval(interval)
+    {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+        {
+            throw std::invalid_argument("Capacity must be a power of two");
+        }
+        if (interval <= 0.0f)
+        {
+            throw std::invalid_argument("Interval must be greater than 0");
+        }
+    }
+
+    /* Returns false if the item was late or a duplicate */
+    bool Insert(uint64_t sequence, const T &item, float arrival)
+    {
+        if (!mStarted)
+        {
+            mNext = sequence;
+            mEnd = sequence;
+        }
+
+        if (sequence < mNext)
+        {
+            mLate++;
+            return false;
+        }
+
+        /* Too far ahead to fit, slide the window up to it and give up on what falls out */
+        if (sequence >= mNext + mSlots.size())
+        {
+            uint64_t next = sequence - mSlots.size() + 1;
+            for (uint64_t s = mNext; s < std::min(next, mEnd); s++)
+            {
+                if (mSlots[s & mMask].filled)
+                {
+                    mSlots[s & mMask].filled = false;
+                    mDropped++;
+                }
+            }
+            mNext = next;
+            mEnd = std::max(mEnd, next);
+        }
+
+        Slot &slot = mSlots[sequence & mMask];
+        if (slot.filled && slot.sequence == sequence)
+        {
+            mDuplicates++;
+            return false;
+        }
+
+        slot.sequence = sequence;
+        slot.filled = true;
+        slot.item = item;
+        mEnd = std::max(mEnd, sequence + 1);
+
+        UpdateJitter(sequence, arrival);
+        mStarted = true;
+        return true;
+    }
+
+    /* Whether sequence has arrived and is still waiting to be played */
+    bool Holds(uint64_t sequence) const
+    {
+        const Slot &slot = mSlots[sequence & mMask];
+        return sequence >= mNext && sequence < mEnd && slot.filled && slot.sequence == sequence;
+    }
+
+    /*
+     * The next item in sequence order. False while the buffer is empty or, after running dry, until it
+     * has refilled to the target depth. Sequences that never arrived are skipped.
+     */
+    bool Pop(T &out)
+    {
+        uint64_t sequence;
+        return Pop(out, sequence);
+    }
+
+    /* Same, and says which sequence the item had */
+    bool Pop(T &out, uint64_t &sequence)
+    {
+        if (mNext == mEnd)
+        {
+            mBuffering = true;
+            return false;
+        }
+
+        if (mBuffering)
+        {
+            if (Depth() < mTargetDepth)
+            {
+                return false;
+            }
+            mBuffering = false;
+        }
+
+        /* mEnd - 1 is always filled, so this stops */
+        while (!mSlots[mNext & mMask].filled)
+        {
+            mNext++;
+            mMissed++;
+        }
+
+        Slot &slot = mSlots[mNext & mMask];
+        slot.filled = false;
+        out = slot.item;
+        sequence = mNext++;
+        return true;
+    }
+
+    /* Sequences from the next to play through the newest received, including gaps */
+    size_t Depth() const
+    {
+        return mEnd - mNext;
+    }
+
+    size_t TargetDepth() const
+    {
+        return mTargetDepth;
+    }
+
+    Stats GetStats() const
+    {
+        return {.depth = Depth(),
+                .targetDepth = mTargetDepth,
+                .jitter = mJitter,
+                .late = mLate,
+                .duplicates = mDuplicates,
+                .dropped = mDropped,
+                .missed = mMissed};
+    }
+};
@@ -0,0 +1,168 @@
+#include "LoadGenerator.hpp"
+#include "Client.hpp"
+#include "Server.hpp"
+#include <iomanip>
+
+namespace
+{
+    std::function<uint8_t(uint64_t)> InputScript(const std::string &name)
+    {
+        if (name == "idle")
+        {
+            return [](uint64_t)
+            { return (uint8_t)0; };
+        }
+        if (name == "circle")
+        {
+            /* Up, right, down, left, half a second each */
+            return [](uint64_t sequence)
+            {
+                const uint8_t sides[] = {1 << 0, 1 << 2, 1 << 1, 1 << 3};
+                return sides[(sequence / 50) % 4];
+            };
+        }
+        /* Empty, so each bot gets the client's own random walk */
+        return {};
+    }
+
+    void Report(int second, const std::vector<std::unique_ptr<Client>> &bots, Client::Stats &previous, Server *server,
+                bool lockstep)
+    {
+        Client::Stats total{};
+        size_t connected = 0;
+        for (auto &bot : bots)
+        {
+            Client::Stats stats = bot->GetStats();
+            total.packetsSent += stats.packetsSent;
+            total.packetsReceived += stats.packetsReceived;
+            total.snapshots += stats.snapshots;
+            total.dotUpdates += stats.dotUpdates;
+            total.reconciliations += stats.reconciliations;
+            total.mispredictions += stats.mispredictions;
+            total.replayedInputs += stats.replayedInputs;
+            total.latencySamples += stats.latencySamples;
+            total.latencySumMs += stats.latencySumMs;
+            total.latencyMaxMs = std::max(total.latencyMaxMs, stats.latencyMaxMs);
+            total.rttMs += stats.rttMs;
+            total.renderDelayMs += stats.renderDelayMs;
+            total.lockstepFrames += stats.lockstepFrames;
+            total.desyncs += stats.desyncs;
+            connected += bot->IsRunning() && (stats.snapshots > 0 || stats.lockstepFrames > 0);
+        }
+
+        uint64_t samples = total.latencySamples - previous.latencySamples;
+        uint64_t reconciliations = total.reconciliations - previous.reconciliations;
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(4) << second << "s  bots " << connected << '/' << bots.size()
+                  << "  out " << total.packetsSent - previous.packetsSent << "/s"
+                  << "  in " << total.packetsReceived - previous.packetsReceived << "/s"
+                  << "  snapshots " << total.snapshots - previous.snapshots << "/s"
+                  << "  latency " << (samples ? (total.latencySumMs - previous.latencySumMs) / samples : 0.0)
+                  << "ms (max " << total.latencyMaxMs << "ms)"
+                  << "  rtt " << total.rttMs / bots.size() << "ms  delay " << total.renderDelayMs / bots.size() << "ms"
+                  << "  mispredicted " << (reconciliations ? 100.0 * (total.mispredictions - previous.mispredictions) / reconciliations : 0.0)
+                  << "% (replayed " << total.replayedInputs - previous.replayedInputs << "/s)";
+
+        if (lockstep)
+        {
+            std::cout << "  frames " << total.lockstepFrames - previous.lockstepFrames << "/s  desyncs "
+                      << total.desyncs - previous.desyncs << "/s";
+        }
+
+        if (server)
+        {
+            Server::TickStats ticks = server->TakeTickStats();
+            std::cout << "  ticks " << ticks.ticks << " mean " << ticks.meanTickMs << "ms max " << ticks.maxTickMs << "ms";
+        }
+        std::cout << '\n';
+
+        previous = total;
+    }
+}
+
+int RunLoadGenerator(const LoadOptions &options)
+{
+    std::unique_ptr<Server> server;
+    std::thread serverThread;
+    if (options.local)
+    {
+        server = std::make_unique<Server>(options.serverPort);
+        server->SetMaxPlayers(options.bots);
+        server->SetLockstep(options.lockstep);
+        server->SetInterestRadius(options.interestRadius, options.interestExitRadius);
+        server->Attach();
+        serverThread = std::thread(&Server::Run, server.get());
+    }
+
+    /* Declared before the bots so they outlive the sockets registered with them */
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    for (int i = 0; i < std::max(options.threads, 1); i++)
+    {
+        loops.push_back(std::make_unique<EventLoop>());
+    }
+
+    std::vector<std::unique_ptr<Client>> bots;
+    for (int i = 0; i < options.bots; i++)
+    {
+        auto bot = std::make_unique<Client>(options.firstPort + i, options.serverPort, 4);
+        bot->SetHeadless(InputScript(options.input));
+        bot->SetInputWindow(options.sendEvery);
+        bot->SetLockstep(options.lockstep);
+        bot->Attach(*loops[i % loops.size()]);
+        bots.push_back(std::move(bot));
+    }
+
+    for (auto &loop : loops)
+    {
+        if (!loop->Start())
+        {
+            std::cerr << "Failed to start event loop\n";
+            return 1;
+        }
+    }
+
+    /* Every bot plays a frame each 10ms, like a client window at 100 FPS */
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+    auto next = start;
+    auto nextReport = start + seconds(1);
+    int second = 0;
+    Client::Stats previous{};
+
+    while (second < options.durationSeconds && !Shutdown::should_shutdown())
+    {
+        for (auto &bot : bots)
+        {
+            if (bot->IsRunning())
+            {
+                bot->Frame();
+            }
+        }
+
+        if (steady_clock::now() >= nextReport)
+        {
+            Report(++second, bots, previous, server.get(), options.lockstep);
+            nextReport += seconds(1);
+        }
+
+        next += milliseconds(10);
+        std::this_thread::sleep_until(next);
+    }
+
+    for (auto &bot : bots)
+    {
+        bot->Disconnect();
+    }
+    for (auto &loop : loops)
+    {
+        loop->Stop();
+    }
+
+    if (server)
+    {
+        Shutdown::request();
+        serverThread.join();
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "Shared.hpp"
+#include <string>
+
+struct LoadOptions
+{
+    int bots{100};
+    /* Bot i binds firstPort + i, which is also its player id */
+    int firstPort{20000};
+    int serverPort{5050};
+    /* Event loops the bots' sockets are spread over */
+    int threads{1};
+    int durationSeconds{10};
+    /* random, circle or idle */
+    std::string input{"random"};
+    /* Frames between input windows, 0 for the batched entries */
+    int sendEvery{0};
+    /* Server and bots exchange lockstep frames instead of snapshots */
+    bool lockstep{false};
+    /* Runs a server in this process too, so its tick times can be reported */
+    bool local{false};
+    /* The local server's, see Server::SetInterestRadius() */
+    float interestRadius{DEFAULT_INTEREST_RADIUS};
+    float interestExitRadius{DEFAULT_INTEREST_EXIT_RADIUS};
+};
+
+/*
+ * Connects options.bots headless clients to a server over loopback and prints what they see once a
+ * second: traffic, snapshot rate and latency, and how often prediction disagreed with the server.
+ * Returns the process exit code
+ */
+int RunLoadGenerator(const LoadOptions &options);
@@ -0,0 +1,361 @@
+#include "Lockstep.hpp"
+
+namespace
+{
+    /* Beyond the world's diagonal every overlap is decided already, and the square stays in 64 bits */
+    constexpr int64_t maxReach = 1024;
+
+    int64_t Reach(uint32_t radius)
+    {
+        return std::min<int64_t>(radius, maxReach) << FIXED_FRACTION_BITS;
+    }
+
+    int64_t DistanceSquared(Fixed ax, Fixed ay, Fixed bx, Fixed by)
+    {
+        int64_t dx = (int64_t)ax - bx;
+        int64_t dy = (int64_t)ay - by;
+        return dx * dx + dy * dy;
+    }
+}
+
+void WriteLockstepFrame(BitWriter &writer, const LockstepFrame &frame)
+{
+    writer.Write(frame.checksum, 32);
+    ChangeCountCodec::Write(writer, frame.leaves.size());
+    ChangeCountCodec::Write(writer, frame.joins.size());
+    LockstepPlayerCountCodec::Write(writer, frame.inputs.size());
+
+    for (int id : frame.leaves)
+    {
+        PlayerIdCodec::Write(writer, id);
+    }
+    for (int id : frame.joins)
+    {
+        PlayerIdCodec::Write(writer, id);
+    }
+    for (uint8_t input : frame.inputs)
+    {
+        InputCodec::Write(writer, input);
+    }
+
+    writer.Write(0, (8 - writer.BitsWritten() % 8) % 8);
+}
+
+void ReadLockstepFrame(BitReader &reader, LockstepFrame &frame)
+{
+    size_t start = reader.BitsRemaining();
+    frame.checksum = (uint32_t)reader.Read(32);
+
+    uint16_t leaves, joins, inputs;
+    ChangeCountCodec::Read(reader, leaves);
+    ChangeCountCodec::Read(reader, joins);
+    LockstepPlayerCountCodec::Read(reader, inputs);
+    if (!reader.Ok())
+    {
+        return;
+    }
+
+    frame.leaves.resize(leaves);
+    frame.joins.resize(joins);
+    frame.inputs.resize(inputs);
+    for (int &id : frame.leaves)
+    {
+        PlayerIdCodec::Read(reader, id);
+    }
+    for (int &id : frame.joins)
+    {
+        PlayerIdCodec::Read(reader, id);
+    }
+    for (uint8_t &input : frame.inputs)
+    {
+        InputCodec::Read(reader, input);
+    }
+
+    reader.Read((8 - (start - reader.BitsRemaining()) % 8) % 8);
+}
+
+void LockstepWorld::Reset(uint64_t seed)
+{
+    mFrame = 0;
+    mRandom.SetState(seed);
+    mPlayers.clear();
+    for (FixedPoint &dot : mDots)
+    {
+        dot = RandomPosition();
+    }
+}
+
+void LockstepWorld::SetState(uint32_t frame, uint64_t random, const FixedPoint *dots, std::vector<LockstepPlayer> players)
+{
+    mFrame = frame;
+    mRandom.SetState(random);
+    memcpy(mDots, dots, sizeof(mDots));
+    mPlayers = std::move(players);
+    mOrder.clear();
+}
+
+bool LockstepWorld::Apply(const LockstepFrame &frame)
+{
+    /* Counted before anything changes, so a frame that doesn't fit leaves the world as it was */
+    auto first = [](const std::vector<int> &ids, size_t i)
+    {
+        return std::find(ids.begin(), ids.begin() + i, ids[i]) == ids.begin() + i;
+    };
+    size_t players = mPlayers.size();
+    for (size_t i = 0; i < frame.leaves.size(); i++)
+    {
+        players -= first(frame.leaves, i) && Find(frame.leaves[i]);
+    }
+    for (size_t i = 0; i < frame.joins.size(); i++)
+    {
+        const int id = frame.joins[i];
+        players += first(frame.joins, i) &&
+                   (!Find(id) || std::find(frame.leaves.begin(), frame.leaves.end(), id) != frame.leaves.end());
+    }
+    if (frame.inputs.size() != players)
+    {
+        return false;
+    }
+
+    /* Indices shift when anyone leaves or joins, the sweep order starts over */
+    if (!frame.leaves.empty() || !frame.joins.empty())
+    {
+        mOrder.clear();
+    }
+    for (int id : frame.leaves)
+    {
+        std::erase_if(mPlayers, [id](const LockstepPlayer &player)
+                      { return player.id == id; });
+    }
+
+    /* A join of a player already in the world is ignored, by every peer alike */
+    for (int id : frame.joins)
+    {
+        auto it = std::lower_bound(mPlayers.begin(), mPlayers.end(), id, [](const LockstepPlayer &player, int id)
+                                   { return player.id < id; });
+        if (it == mPlayers.end() || it->id != id)
+        {
+            FixedPoint spawn = RandomPosition();
+            mPlayers.insert(it, {.id = id, .x = spawn.x, .y = spawn.y, .radius = 10});
+        }
+    }
+
+    for (size_t i = 0; i < mPlayers.size(); i++)
+    {
+        Move(mPlayers[i].x, mPlayers[i].y, frame.inputs[i], mPlayers[i].radius);
+    }
+
+    CheckPlayerCollisions();
+    CheckDotCollisions();
+    mFrame++;
+    return true;
+}
+
+/*
+ * Sweep and prune along x: players sorted by x, each only checked against those within the largest
+ * reach to its right. Players move a little each frame, so last frame's order is nearly sorted and an
+ * insertion sort fixes it in about linear time. Contacts are then applied in id order with the
+ * server's rules
+ */
+void LockstepWorld::CheckPlayerCollisions()
+{
+    if (mOrder.size() != mPlayers.size())
+    {
+        mOrder.resize(mPlayers.size());
+        for (uint32_t i = 0; i < mPlayers.size(); i++)
+        {
+            mOrder[i] = i;
+        }
+    }
+
+    auto before = [&](uint32_t a, uint32_t b)
+    {
+        return mPlayers[a].x != mPlayers[b].x ? mPlayers[a].x < mPlayers[b].x : a < b;
+    };
+    for (size_t i = 1; i < mOrder.size(); i++)
+    {
+        uint32_t moving = mOrder[i];
+        size_t j = i;
+        for (; j > 0 && before(moving, mOrder[j - 1]); j--)
+        {
+            mOrder[j] = mOrder[j - 1];
+        }
+        mOrder[j] = moving;
+    }
+
+    /* Copied out in sweep order, so the inner loop reads memory front to back */
+    int64_t reach = 0;
+    mSorted.resize(mOrder.size());
+    for (size_t i = 0; i < mOrder.size(); i++)
+    {
+        mSorted[i] = mPlayers[mOrder[i]];
+        reach = std::max(reach, Reach(mSorted[i].radius));
+    }
+
+    mContacts.clear();
+    for (size_t a = 0; a < mSorted.size(); a++)
+    {
+        const LockstepPlayer &first = mSorted[a];
+        for (size_t b = a + 1; b < mSorted.size() && (int64_t)mSorted[b].x - first.x < reach; b++)
+        {
+            const LockstepPlayer &second = mSorted[b];
+            if (first.radius == second.radius || std::abs((int64_t)second.y - first.y) >= reach)
+            {
+                continue;
+            }
+
+            bool firstEats = first.radius > second.radius;
+            int64_t range = Reach(firstEats ? first.radius : second.radius);
+            if (DistanceSquared(first.x, first.y, second.x, second.y) < range * range)
+            {
+                mContacts.push_back(firstEats ? Contact{mOrder[a], mOrder[b]} : Contact{mOrder[b], mOrder[a]});
+            }
+        }
+    }
+    std::sort(mContacts.begin(), mContacts.end());
+
+    mEaten.assign(mPlayers.size(), false);
+    for (const Contact &contact : mContacts)
+    {
+        LockstepPlayer &eater = mPlayers[contact.eater];
+        LockstepPlayer &target = mPlayers[contact.target];
+        if (mEaten[contact.eater] || mEaten[contact.target] || eater.radius <= target.radius)
+        {
+            continue;
+        }
+
+        eater.radius = std::min(eater.radius + target.radius, MAX_PLAYER_RADIUS);
+        target.radius = 10;
+        FixedPoint respawn = RandomPosition();
+        target.x = respawn.x;
+        target.y = respawn.y;
+        mEaten[contact.target] = true;
+    }
+}
+
+void LockstepWorld::CheckDotCollisions()
+{
+    /* Each dot goes to the first player in id order that reached it, a respawn can be eaten next frame */
+    bool eaten[DOT_COUNT] = {};
+    for (LockstepPlayer &player : mPlayers)
+    {
+        int64_t range = Reach(player.radius);
+        for (int i = 0; i < DOT_COUNT; i++)
+        {
+            if (!eaten[i] && DistanceSquared(player.x, player.y, mDots[i].x, mDots[i].y) <= range * range)
+            {
+                player.radius = std::min(player.radius + 1, MAX_PLAYER_RADIUS);
+                mDots[i] = RandomPosition();
+                eaten[i] = true;
+            }
+        }
+    }
+}
+
+uint32_t LockstepWorld::Frame() const
+{
+    return mFrame;
+}
+
+uint64_t LockstepWorld::RandomState() const
+{
+    return mRandom.State();
+}
+
+const std::vector<LockstepPlayer> &LockstepWorld::Players() const
+{
+    return mPlayers;
+}
+
+const FixedPoint *LockstepWorld::Dots() const
+{
+    return mDots;
+}
+
+const LockstepPlayer *LockstepWorld::Find(int id) const
+{
+    auto it = std::lower_bound(mPlayers.begin(), mPlayers.end(), id, [](const LockstepPlayer &player, int id)
+                               { return player.id < id; });
+    return it != mPlayers.end() && it->id == id ? &*it : nullptr;
+}
+
+uint32_t LockstepWorld::Checksum() const
+{
+    uint64_t hash = 1469598103934665603ull;
+    auto mix = [&](uint32_t value)
+    {
+        hash = (hash ^ value) * 1099511628211ull;
+    };
+
+    mix(mFrame);
+    mix((uint32_t)mRandom.State());
+    mix((uint32_t)(mRandom.State() >> 32));
+    for (const FixedPoint &dot : mDots)
+    {
+        mix((uint32_t)dot.x);
+        mix((uint32_t)dot.y);
+    }
+    for (const LockstepPlayer &player : mPlayers)
+    {
+        mix((uint32_t)player.id);
+        mix((uint32_t)player.x);
+        mix((uint32_t)player.y);
+        mix(player.radius);
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+void LockstepWorld::Move(Fixed &x, Fixed &y, uint8_t input, uint32_t radius)
+{
+    const Fixed speed = ToFixed(10) / (Fixed)std::max(radius, (uint32_t)10);
+
+    if (input & (1 << 0))
+        y -= speed;
+    if (input & (1 << 1))
+        y += speed;
+    if (input & (1 << 2))
+        x += speed;
+    if (input & (1 << 3))
+        x -= speed;
+
+    x = std::clamp(x, ToFixed(-(WORLD_WIDTH / 2)), ToFixed(WORLD_WIDTH / 2));
+    y = std::clamp(y, ToFixed(-(WORLD_HEIGHT / 2)), ToFixed(WORLD_HEIGHT / 2));
+}
+
+FixedPoint LockstepWorld::RandomPosition()
+{
+    Fixed x = ToFixed(mRandom.Range(-(WORLD_WIDTH / 2), WORLD_WIDTH / 2));
+    Fixed y = ToFixed(mRandom.Range(-(WORLD_HEIGHT / 2), WORLD_HEIGHT / 2));
+    return {x, y};
+}
+
+void EncodeLockstepState(const LockstepWorld &world, std::vector<char> &data, std::vector<uint16_t> &sizes)
+{
+    const std::vector<LockstepPlayer> &players = world.Players();
+
+    LockstepStatePacket header;
+    header.frame = world.Frame();
+    header.random = world.RandomState();
+    memcpy(header.dots, world.Dots(), sizeof(header.dots));
+    header.fragmentCount = std::max<size_t>((players.size() + LOCKSTEP_PLAYERS_PER_STATE - 1) / LOCKSTEP_PLAYERS_PER_STATE, 1);
+
+    for (size_t fragment = 0; fragment < header.fragmentCount; fragment++)
+    {
+        size_t first = fragment * LOCKSTEP_PLAYERS_PER_STATE;
+        size_t last = std::min(players.size(), first + LOCKSTEP_PLAYERS_PER_STATE);
+        size_t offset = data.size();
+        data.resize(offset + MAX_DATAGRAM_SIZE);
+        BitWriter writer(&data[offset], MAX_DATAGRAM_SIZE);
+
+        header.fragmentIndex = fragment;
+        header.playerCount = last - first;
+        SchemaOf<LockstepStatePacket>::Type::Write(writer, header);
+        for (size_t i = first; i < last; i++)
+        {
+            SchemaOf<LockstepPlayer>::Type::Write(writer, players[i]);
+        }
+
+        data.resize(offset + writer.BytesWritten());
+        sizes.push_back(writer.BytesWritten());
+    }
+}
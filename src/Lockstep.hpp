@@ -0,0 +1,261 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Shared.hpp"
+
+/*
+ * Deterministic simulation for lockstep play. Positions are Q16.16 fixed point, randomness comes from
+ * a SplitMix64 stream and players are always visited in id order, so every peer that starts from the
+ * same state and applies the same frames ends up bit for bit in the same world, whatever its compiler,
+ * standard library or FPU. Floats only appear when a position is drawn.
+ *
+ * A frame is one client input interval: the players that left and joined, then one input per player
+ * in id order. Peers exchange frames instead of positions and check each other with Checksum().
+ */
+
+using Fixed = int32_t;
+constexpr int FIXED_FRACTION_BITS = 16;
+constexpr Fixed FIXED_ONE = 1 << FIXED_FRACTION_BITS;
+
+constexpr Fixed ToFixed(int value)
+{
+    return value * FIXED_ONE;
+}
+
+inline float FixedToFloat(Fixed value)
+{
+    return (float)value / FIXED_ONE;
+}
+
+/* Players joining or leaving in one frame, more wait for the next */
+#define LOCKSTEP_MAX_CHANGES 32
+/* Every player's input has to fit one datagram alongside the frame's changes */
+#define LOCKSTEP_MAX_PLAYERS 1024
+/* Encoded frames the server keeps for resending, a client further behind is sent the whole world */
+#define LOCKSTEP_HISTORY 256
+/* Most frames resent to one client in a tick */
+#define LOCKSTEP_RESEND_FRAMES 64
+/* Frames a client buffers before it fast forwards, a couple of ticks at the default rate */
+#define LOCKSTEP_PLAYOUT_FRAMES 20
+
+/* SplitMix64. The standard distributions differ between library implementations, this doesn't */
+class DeterministicRandom
+{
+    uint64_t mState;
+
+public:
+    explicit DeterministicRandom(uint64_t seed = 0) : mState(seed)
+    {
+    }
+
+    uint64_t Next()
+    {
+        uint64_t z = (mState += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    /* Uniform in [min, max], by multiply and shift so no division is involved */
+    int32_t Range(int32_t min, int32_t max)
+    {
+        uint64_t span = (uint64_t)((int64_t)max - min) + 1;
+        return (int32_t)(min + (int64_t)(((Next() >> 32) * span) >> 32));
+    }
+
+    uint64_t State() const
+    {
+        return mState;
+    }
+
+    void SetState(uint64_t state)
+    {
+        mState = state;
+    }
+};
+
+struct FixedPoint
+{
+    Fixed x;
+    Fixed y;
+};
+
+struct LockstepPlayer
+{
+    int id;
+    Fixed x;
+    Fixed y;
+    uint32_t radius;
+};
+
+struct LockstepFrame
+{
+    std::vector<int> leaves;
+    std::vector<int> joins;
+    /* One per player after the leaves and joins, in id order */
+    std::vector<uint8_t> inputs;
+    /* Of the world once the frame is applied */
+    uint32_t checksum{0};
+};
+
+/* Positions go out exactly, a joining peer has to start from the same bits as everyone else */
+using FixedX = FixedPointCodec<-(WORLD_WIDTH / 2), WORLD_WIDTH / 2, FIXED_FRACTION_BITS>;
+using FixedY = FixedPointCodec<-(WORLD_HEIGHT / 2), WORLD_HEIGHT / 2, FIXED_FRACTION_BITS>;
+using FrameCodec = UIntCodec<uint32_t, UINT32_MAX>;
+using ChangeCountCodec = UIntCodec<uint16_t, LOCKSTEP_MAX_CHANGES>;
+using LockstepPlayerCountCodec = UIntCodec<uint16_t, LOCKSTEP_MAX_PLAYERS>;
+
+template <>
+struct SchemaOf<FixedPoint>
+{
+    using Type = Schema<FixedPoint, Field<&FixedPoint::x, FixedX>, Field<&FixedPoint::y, FixedY>>;
+};
+
+template <>
+struct SchemaOf<LockstepPlayer>
+{
+    using Type = Schema<LockstepPlayer,
+                        Field<&LockstepPlayer::id, PlayerIdCodec>,
+                        Field<&LockstepPlayer::x, FixedX>,
+                        Field<&LockstepPlayer::y, FixedY>,
+                        Field<&LockstepPlayer::radius, RadiusCodec>>;
+};
+
+/*
+ * Lockstep frames firstFrame onward, for a client that asked for them with a FrameAckPacket. The
+ * frames start on the byte after the header, each byte aligned (see WriteLockstepFrame), so the server
+ * encodes a frame once and copies it into every client's datagram.
+ */
+struct LockstepFramesPacket
+{
+    PacketHeader header{.type = MSG::LOCKSTEP_FRAMES};
+    /* The server's world had reached newestFrame having played processedInputs of this client's inputs */
+    uint64_t processedInputs;
+    uint32_t newestFrame;
+    uint32_t firstFrame;
+    uint16_t frameCount;
+};
+
+/* One fragment of the whole world at a frame, followed by playerCount LockstepPlayers in id order */
+struct LockstepStatePacket
+{
+    PacketHeader header{.type = MSG::LOCKSTEP_STATE};
+    uint32_t frame;
+    uint64_t random;
+    FixedPoint dots[DOT_COUNT];
+    uint16_t fragmentIndex;
+    uint16_t fragmentCount;
+    uint16_t playerCount;
+};
+
+/* The next frame the client wants, so every frame the server sent from then on. NO_FRAME asks for the world */
+struct FrameAckPacket
+{
+    PacketHeader header{.type = MSG::FRAME_ACK};
+    uint32_t nextFrame;
+};
+
+template <>
+struct SchemaOf<LockstepFramesPacket>
+{
+    using Type = Schema<LockstepFramesPacket,
+                        Field<&LockstepFramesPacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&LockstepFramesPacket::processedInputs, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&LockstepFramesPacket::newestFrame, FrameCodec>,
+                        Field<&LockstepFramesPacket::firstFrame, FrameCodec>,
+                        Field<&LockstepFramesPacket::frameCount, UIntCodec<uint16_t, LOCKSTEP_RESEND_FRAMES>>>;
+};
+
+template <>
+struct SchemaOf<LockstepStatePacket>
+{
+    using Type = Schema<LockstepStatePacket,
+                        Field<&LockstepStatePacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&LockstepStatePacket::frame, FrameCodec>,
+                        Field<&LockstepStatePacket::random, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&LockstepStatePacket::dots, ArrayCodec<SchemaOf<FixedPoint>::Type, DOT_COUNT>>,
+                        Field<&LockstepStatePacket::fragmentIndex, UIntCodec<uint16_t, UINT16_MAX>>,
+                        Field<&LockstepStatePacket::fragmentCount, UIntCodec<uint16_t, UINT16_MAX>>,
+                        Field<&LockstepStatePacket::playerCount, LockstepPlayerCountCodec>>;
+};
+
+template <>
+struct SchemaOf<FrameAckPacket>
+{
+    using Type = Schema<FrameAckPacket,
+                        Field<&FrameAckPacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&FrameAckPacket::nextFrame, FrameCodec>>;
+};
+
+constexpr size_t LOCKSTEP_FRAME_HEADER_BITS = 32 + 2 * ChangeCountCodec::bits + LockstepPlayerCountCodec::bits;
+constexpr size_t MAX_LOCKSTEP_FRAME_BITS =
+    LOCKSTEP_FRAME_HEADER_BITS + 2 * LOCKSTEP_MAX_CHANGES * PlayerIdCodec::bits + LOCKSTEP_MAX_PLAYERS * InputCodec::bits;
+
+static_assert(SchemaOf<LockstepFramesPacket>::Type::bytes * 8 + MAX_LOCKSTEP_FRAME_BITS + 7 <= MAX_DATAGRAM_SIZE * 8);
+
+constexpr size_t LOCKSTEP_PLAYERS_PER_STATE =
+    (MAX_DATAGRAM_SIZE * 8 - SchemaOf<LockstepStatePacket>::Type::bits) / SchemaOf<LockstepPlayer>::Type::bits;
+
+/* Checksum, counts, then the ids and inputs. Pads to a whole byte */
+void WriteLockstepFrame(BitWriter &writer, const LockstepFrame &frame);
+
+/* Skips the padding too, check reader.Ok() afterwards */
+void ReadLockstepFrame(BitReader &reader, LockstepFrame &frame);
+
+class LockstepWorld
+{
+    struct Contact
+    {
+        uint32_t eater;
+        uint32_t target;
+
+        bool operator<(const Contact &other) const
+        {
+            return eater != other.eater ? eater < other.eater : target < other.target;
+        }
+    };
+
+    uint32_t mFrame{0};
+    DeterministicRandom mRandom;
+    /* Sorted by id */
+    std::vector<LockstepPlayer> mPlayers;
+    FixedPoint mDots[DOT_COUNT]{};
+
+    /* Player indices by x for the sweep, kept from frame to frame */
+    std::vector<uint32_t> mOrder;
+    std::vector<LockstepPlayer> mSorted;
+    std::vector<Contact> mContacts;
+    std::vector<bool> mEaten;
+
+    FixedPoint RandomPosition();
+    void CheckPlayerCollisions();
+    void CheckDotCollisions();
+
+public:
+    /* Frame 0, no players and dots placed from seed */
+    void Reset(uint64_t seed);
+
+    /* Takes over a world some peer sent, players sorted by id */
+    void SetState(uint32_t frame, uint64_t random, const FixedPoint *dots, std::vector<LockstepPlayer> players);
+
+    /* False, with the world untouched, if the frame doesn't hold an input for every player */
+    bool Apply(const LockstepFrame &frame);
+
+    /* The next frame to apply */
+    uint32_t Frame() const;
+    uint64_t RandomState() const;
+    const std::vector<LockstepPlayer> &Players() const;
+    const FixedPoint *Dots() const;
+    const LockstepPlayer *Find(int id) const;
+
+    /* FNV-1a over everything Apply() depends on, a 32 bit value at a time so it is the same on any host */
+    uint32_t Checksum() const;
+
+    /* ApplyInput in fixed point, clamped to the world */
+    static void Move(Fixed &x, Fixed &y, uint8_t input, uint32_t radius);
+};
+
+/* The world split over datagrams, appended to data with one entry in sizes per fragment */
+void EncodeLockstepState(const LockstepWorld &world, std::vector<char> &data, std::vector<uint16_t> &sizes);
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Runtime counters with a single writer thread each. The writer updates them with relaxed loads and
+ * stores, no locked instructions and no locks, and any thread may read them at any time. A value with
+ * several writers is kept once per writer and summed by whoever reads it.
+ */
+class Counter
+{
+    std::atomic<uint64_t> mValue{0};
+
+public:
+    void Add(uint64_t amount)
+    {
+        mValue.store(mValue.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    void Set(uint64_t value)
+    {
+        mValue.store(value, std::memory_order_relaxed);
+    }
+
+    uint64_t Load() const
+    {
+        return mValue.load(std::memory_order_relaxed);
+    }
+};
+
+/*
+ * Durations in power of two microsecond buckets: bucket b counts durations below 2^b us that didn't
+ * fit the bucket before, the last one everything longer. Percentiles are reported as the upper bound
+ * of their bucket, so they are within a factor of two, which is plenty to see which phase blew a tick.
+ */
+class Histogram
+{
+public:
+    static constexpr size_t bucketCount = 24;
+
+    struct Summary
+    {
+        uint64_t count;
+        double meanMs;
+        double p50Ms;
+        double p99Ms;
+        double maxMs;
+    };
+
+private:
+    Counter mBuckets[bucketCount];
+    Counter mSumMicros;
+    Counter mMaxMicros;
+
+    double Percentile(const uint64_t *buckets, uint64_t count, double fraction) const
+    {
+        uint64_t rank = (uint64_t)(count * fraction);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < bucketCount; b++)
+        {
+            seen += buckets[b];
+            if (seen > rank)
+            {
+                return (double)(1ull << b) / 1000.0;
+            }
+        }
+        return mMaxMicros.Load() / 1000.0;
+    }
+
+public:
+    void Record(uint64_t micros)
+    {
+        mBuckets[std::min<size_t>(std::bit_width(micros), bucketCount - 1)].Add(1);
+        mSumMicros.Add(micros);
+        if (micros > mMaxMicros.Load())
+        {
+            mMaxMicros.Set(micros);
+        }
+    }
+
+    /* Since the start, read while the writer may be mid update, so off by at most a sample */
+    Summary Summarize() const
+    {
+        uint64_t buckets[bucketCount];
+        uint64_t count = 0;
+        for (size_t b = 0; b < bucketCount; b++)
+        {
+            buckets[b] = mBuckets[b].Load();
+            count += buckets[b];
+        }
+
+        if (count == 0)
+        {
+            return {.count = 0, .meanMs = 0, .p50Ms = 0, .p99Ms = 0, .maxMs = 0};
+        }
+
+        return {.count = count,
+                .meanMs = mSumMicros.Load() / 1000.0 / count,
+                .p50Ms = std::min(Percentile(buckets, count, 0.5), mMaxMicros.Load() / 1000.0),
+                .p99Ms = std::min(Percentile(buckets, count, 0.99), mMaxMicros.Load() / 1000.0),
+                .maxMs = mMaxMicros.Load() / 1000.0};
+    }
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+/*
+ * Bounded lock-free multi-producer single-consumer queue (Vyukov's sequenced ring).
+ * Each cell carries a sequence number telling producers and the consumer whose turn it is,
+ * so neither side ever blocks the other. Push fails instead of waiting when the ring is full.
+ */
+template <typename T>
+class MpscQueue
+{
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+private:
+    std::unique_ptr<Cell[]> mCells;
+    size_t mMask;
+    alignas(64) std::atomic<size_t> mEnqueuePos{0};
+    alignas(64) std::atomic<size_t> mDequeuePos{0};
+    alignas(64) std::atomic<uint64_t> mOverflows{0};
+
+public:
+    explicit MpscQueue(size_t capacity)
+    {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+        {
+            throw std::invalid_argument("Capacity must be a power of two");
+        }
+
+        mCells = std::make_unique<Cell[]>(capacity);
+        mMask = capacity - 1;
+        for (size_t i = 0; i < capacity; i++)
+        {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    /* Any thread. Returns false and counts an overflow if the queue is full */
+    bool Push(const T &value)
+    {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            Cell &cell = mCells[pos & mMask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                mOverflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else
+            {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /* Consumer thread only */
+    bool Pop(T &value)
+    {
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Cell &cell = mCells[pos & mMask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+        if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0)
+        {
+            return false;
+        }
+
+        value = std::move(cell.value);
+        cell.sequence.store(pos + mMask + 1, std::memory_order_release);
+        mDequeuePos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /* Approximate when producers are active */
+    size_t size() const
+    {
+        size_t enqueued = mEnqueuePos.load(std::memory_order_relaxed);
+        size_t dequeued = mDequeuePos.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t capacity() const
+    {
+        return mMask + 1;
+    }
+
+    uint64_t overflows() const
+    {
+        return mOverflows.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,151 @@
+#include "PlayerStore.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+void PlayerStore::ApplyPendingInputs()
+{
+    ApplyInputRows(0, x.size());
+    ClearInputs();
+}
+
+void PlayerStore::ApplyInputRows(size_t begin, size_t end)
+{
+    for (int row = 0; row < INPUT_BUFFER_SIZE; row++)
+    {
+        ApplyInputs(&x[begin], &y[begin], &radius[begin], InputRow(row) + begin, end - begin);
+    }
+}
+
+void ApplyInputsScalar(float *x, float *y, const uint32_t *radius, const uint8_t *input, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        Vector2 position = {x[i], y[i]};
+        ApplyInput(&position, input[i], radius[i]);
+        x[i] = position.x;
+        y[i] = position.y;
+    }
+}
+
+void DistanceSquared(const float *x, const float *y, size_t stride, const uint32_t *indices, size_t count,
+                     float cx, float cy, float *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float dx = cx - x[indices[i] * stride];
+        float dy = cy - y[indices[i] * stride];
+        out[i] = dx * dx + dy * dy;
+    }
+}
+
+/*
+ * The vector kernels mirror ApplyInput operation for operation, so every lane rounds exactly as the
+ * scalar code does: the same subtract/add order, a true division for the speed and the same clamp to
+ * the world. Radii are assumed below 2^31.
+ */
+
+#if defined(__AVX2__)
+
+static __m256 Clamp(__m256 value, float half)
+{
+    return _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(-half)), _mm256_set1_ps(half));
+}
+
+void ApplyInputs(float *x, float *y, const uint32_t *radius, const uint8_t *input, size_t count)
+{
+    const __m256i one = _mm256_set1_epi32(1 << 0), two = _mm256_set1_epi32(1 << 1);
+    const __m256i four = _mm256_set1_epi32(1 << 2), eight = _mm256_set1_epi32(1 << 3);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i bits = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&input[i]));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)&radius[i]));
+        __m256 speed = _mm256_div_ps(_mm256_set1_ps(10.0f), _mm256_max_ps(r, _mm256_set1_ps(10.0f)));
+        __m256 px = _mm256_loadu_ps(&x[i]);
+        __m256 py = _mm256_loadu_ps(&y[i]);
+
+        auto set = [&](__m256i flag)
+        { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(bits, flag), flag)); };
+
+        py = _mm256_blendv_ps(py, _mm256_sub_ps(py, speed), set(one));
+        py = _mm256_blendv_ps(py, _mm256_add_ps(py, speed), set(two));
+        px = _mm256_blendv_ps(px, _mm256_add_ps(px, speed), set(four));
+        px = _mm256_blendv_ps(px, _mm256_sub_ps(px, speed), set(eight));
+
+        _mm256_storeu_ps(&x[i], Clamp(px, WORLD_WIDTH / 2));
+        _mm256_storeu_ps(&y[i], Clamp(py, WORLD_HEIGHT / 2));
+    }
+
+    ApplyInputsScalar(x + i, y + i, radius + i, input + i, count - i);
+}
+
+const char *KernelIsa()
+{
+    return "AVX2";
+}
+
+#elif defined(__SSE2__)
+
+static __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static __m128 Clamp(__m128 value, float half)
+{
+    return _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(-half)), _mm_set1_ps(half));
+}
+
+void ApplyInputs(float *x, float *y, const uint32_t *radius, const uint8_t *input, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1 << 0), two = _mm_set1_epi32(1 << 1);
+    const __m128i four = _mm_set1_epi32(1 << 2), eight = _mm_set1_epi32(1 << 3);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        int packed;
+        memcpy(&packed, &input[i], sizeof(packed));
+        __m128i bits = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+        __m128 r = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)&radius[i]));
+        __m128 speed = _mm_div_ps(_mm_set1_ps(10.0f), _mm_max_ps(r, _mm_set1_ps(10.0f)));
+        __m128 px = _mm_loadu_ps(&x[i]);
+        __m128 py = _mm_loadu_ps(&y[i]);
+
+        auto set = [&](__m128i flag)
+        { return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(bits, flag), flag)); };
+
+        py = Select(set(one), _mm_sub_ps(py, speed), py);
+        py = Select(set(two), _mm_add_ps(py, speed), py);
+        px = Select(set(four), _mm_add_ps(px, speed), px);
+        px = Select(set(eight), _mm_sub_ps(px, speed), px);
+
+        _mm_storeu_ps(&x[i], Clamp(px, WORLD_WIDTH / 2));
+        _mm_storeu_ps(&y[i], Clamp(py, WORLD_HEIGHT / 2));
+    }
+
+    ApplyInputsScalar(x + i, y + i, radius + i, input + i, count - i);
+}
+
+const char *KernelIsa()
+{
+    return "SSE2";
+}
+
+#else
+
+void ApplyInputs(float *x, float *y, const uint32_t *radius, const uint8_t *input, size_t count)
+{
+    ApplyInputsScalar(x, y, radius, input, count);
+}
+
+const char *KernelIsa()
+{
+    return "scalar";
+}
+
+#endif
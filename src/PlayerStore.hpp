@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Shared.hpp"
+
+/*
+ * Simulation state of every player as parallel arrays, indexed by ClientTable slot so the index of a
+ * player never changes while it is connected. Free slots stay in the arrays with no pending input, the
+ * kernels run over them harmlessly instead of branching around holes.
+ *
+ * Pending inputs are INPUT_BUFFER_SIZE rows of one byte per slot: row k holds the k-th input of the
+ * entry each player is applying this round, 0 for players with nothing to apply.
+ */
+class PlayerStore
+{
+public:
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<uint32_t> radius;
+    std::vector<uint8_t> input;
+
+    /* Grows to at least slots, never shrinks */
+    void Reserve(size_t slots)
+    {
+        if (slots <= x.size())
+        {
+            return;
+        }
+
+        x.resize(slots, 0.0f);
+        y.resize(slots, 0.0f);
+        radius.resize(slots, 10);
+
+        /* Rows are slots wide, so widening reshapes the whole block */
+        std::vector<uint8_t> widened(slots * INPUT_BUFFER_SIZE, 0);
+        size_t old = input.size() / INPUT_BUFFER_SIZE;
+        for (size_t row = 0; row < INPUT_BUFFER_SIZE && old; row++)
+        {
+            memcpy(&widened[row * slots], &input[row * old], old);
+        }
+        input.swap(widened);
+    }
+
+    size_t size() const
+    {
+        return x.size();
+    }
+
+    void Reset(uint32_t slot, Vector2 position, uint32_t playerRadius)
+    {
+        x[slot] = position.x;
+        y[slot] = position.y;
+        radius[slot] = playerRadius;
+    }
+
+    Vector2 Position(uint32_t slot) const
+    {
+        return {x[slot], y[slot]};
+    }
+
+    void SetPosition(uint32_t slot, Vector2 position)
+    {
+        x[slot] = position.x;
+        y[slot] = position.y;
+    }
+
+    uint8_t *InputRow(int row)
+    {
+        return &input[row * x.size()];
+    }
+
+    void ClearInputs()
+    {
+        std::fill(input.begin(), input.end(), 0);
+    }
+
+    /* Applies every pending input row in order, then clears them */
+    void ApplyPendingInputs();
+
+    /* Applies the pending rows to slots [begin, end) only, leaving them set. Disjoint ranges can run concurrently */
+    void ApplyInputRows(size_t begin, size_t end);
+};
+
+/*
+ * Kernels over the arrays above. ApplyInputs is bit-identical to calling ApplyInput on every lane and
+ * picks AVX2 or SSE2 when the build targets them, falling back to scalar.
+ */
+void ApplyInputs(float *x, float *y, const uint32_t *radius, const uint8_t *input, size_t count);
+void ApplyInputsScalar(float *x, float *y, const uint32_t *radius, const uint8_t *input, size_t count);
+
+/*
+ * (cx - x)^2 + (cy - y)^2 for the positions at indices * stride. Scalar only: the loads are by index,
+ * queries return a handful of candidates, and vector versions measured no faster
+ */
+void DistanceSquared(const float *x, const float *y, size_t stride, const uint32_t *indices, size_t count,
+                     float cx, float cy, float *out);
+
+/* Which kernels ApplyInputs dispatches to */
+const char *KernelIsa();
@@ -0,0 +1,178 @@
+#include "Replay.hpp"
+#include "Server.hpp"
+#include "Capture.hpp"
+#include <iomanip>
+
+struct ReplayAccess
+{
+    /* Shards without sockets, so datagrams land where they were received and drain in the same order */
+    static void Prepare(Server &server, uint32_t shards)
+    {
+        server.mOffline = true;
+        while (server.mShards.size() < shards)
+        {
+            server.mShards.push_back(std::make_unique<Server::Shard>());
+        }
+    }
+
+    static void Ingest(Server &server, const char *data, int size, sockaddr_in sender, uint32_t shard, float arrival)
+    {
+        server.Ingest(data, size, sender, shard, arrival);
+    }
+
+    static void Tick(Server &server, uint64_t tick, double time)
+    {
+        server.TickAt(tick, time);
+    }
+
+    /* FNV-1a over every client's id, position and radius in table order, then the dots, onto hash */
+    static uint64_t Checksum(Server &server, uint64_t hash)
+    {
+        auto mix = [&](const void *data, size_t size)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash = (hash ^ ((const uint8_t *)data)[i]) * 1099511628211ull;
+            }
+        };
+
+        for (auto &[address, client] : server.mClients)
+        {
+            mix(&client.id, sizeof(client.id));
+            mix(&server.mWorld.x[client.slot], sizeof(float));
+            mix(&server.mWorld.y[client.slot], sizeof(float));
+            mix(&server.mWorld.radius[client.slot], sizeof(uint32_t));
+        }
+        mix(server.mDots, sizeof(server.mDots));
+
+        uint32_t lockstep = server.mLockstepWorld.Checksum();
+        mix(&lockstep, sizeof(lockstep));
+        return hash;
+    }
+};
+
+namespace
+{
+    struct Pass
+    {
+        uint64_t ticks;
+        uint64_t datagrams;
+        double seconds;
+        Histogram::Summary tick;
+        /* Of the world after every tick, so passes that diverge and reconverge still differ */
+        uint64_t checksum;
+        size_t players;
+    };
+
+    Pass ReplayOnce(CaptureReader &capture, int threads)
+    {
+        const CaptureHeader &header = capture.Header();
+        Server server(0);
+        server.SetSeed(header.seed);
+        server.SetTickRate(header.tickRate);
+        server.SetMaxPlayers(header.maxPlayers);
+        server.SetWorkerThreads(threads);
+        server.SetLockstep(header.lockstep != 0);
+        ReplayAccess::Prepare(server, header.shards);
+        server.Start();
+
+        using Clock = std::chrono::steady_clock;
+        Histogram ticks;
+        Pass pass{.ticks = 0, .datagrams = 0, .seconds = 0, .tick = {}, .checksum = 1469598103934665603ull, .players = 0};
+        double checksumSeconds = 0;
+        auto start = Clock::now();
+
+        CaptureRecord record;
+        const char *payload;
+        capture.Rewind();
+        while (capture.Next(record, payload))
+        {
+            if (record.kind == CaptureKind::DATAGRAM)
+            {
+                sockaddr_in sender{};
+                sender.sin_family = AF_INET;
+                sender.sin_addr.s_addr = record.address;
+                sender.sin_port = record.port;
+                ReplayAccess::Ingest(server, payload, record.size, sender, record.shard % header.shards, record.arrival);
+                pass.datagrams++;
+                continue;
+            }
+
+            CaptureTick marker;
+            memcpy(&marker, payload, sizeof(marker));
+            auto begin = Clock::now();
+            ReplayAccess::Tick(server, marker.tick, marker.time);
+            auto end = Clock::now();
+            ticks.Record(std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count());
+            pass.ticks++;
+
+            pass.checksum = ReplayAccess::Checksum(server, pass.checksum);
+            pass.players = std::max(pass.players, server.PlayerCount());
+            checksumSeconds += std::chrono::duration<double>(Clock::now() - end).count();
+        }
+
+        pass.seconds = std::chrono::duration<double>(Clock::now() - start).count() - checksumSeconds;
+        pass.tick = ticks.Summarize();
+        return pass;
+    }
+}
+
+int RunReplay(const ReplayOptions &options)
+{
+    CaptureReader capture;
+    if (!capture.Open(options.path))
+    {
+        return 1;
+    }
+
+    const CaptureHeader &header = capture.Header();
+    if (!options.json)
+    {
+        std::cout << options.path << ": seed " << header.seed << ", " << header.tickRate << " Hz, "
+                  << (header.lockstep ? "lockstep, " : "")
+                  << header.shards << " shard(s), " << options.threads << " thread(s)\n";
+    }
+
+    uint64_t firstChecksum = 0;
+    bool diverged = false;
+    for (int i = 0; i < std::max(options.repeat, 1); i++)
+    {
+        /* The server logs every join and leave, which would bury the report */
+        std::streambuf *out = std::cout.rdbuf(nullptr);
+        Pass pass = ReplayOnce(capture, options.threads);
+        std::cout.rdbuf(out);
+        std::cout.clear();
+
+        if (i == 0)
+        {
+            firstChecksum = pass.checksum;
+        }
+        diverged |= pass.checksum != firstChecksum;
+
+        if (options.json)
+        {
+            std::cout << std::fixed << std::setprecision(3) << "{\"pass\":" << i << ",\"ticks\":" << pass.ticks
+                      << ",\"datagrams\":" << pass.datagrams << ",\"peak_players\":" << pass.players
+                      << ",\"seconds\":" << pass.seconds << ",\"tick_mean_ms\":" << pass.tick.meanMs
+                      << ",\"tick_p50_ms\":" << pass.tick.p50Ms << ",\"tick_p99_ms\":" << pass.tick.p99Ms
+                      << ",\"tick_max_ms\":" << pass.tick.maxMs << ",\"checksum\":\"" << std::hex
+                      << pass.checksum << std::dec << "\"}\n";
+        }
+        else
+        {
+            std::cout << std::fixed << std::setprecision(3) << "pass " << i << ": " << pass.ticks << " ticks, "
+                      << pass.datagrams << " datagrams, " << pass.players << " players at most, in " << pass.seconds
+                      << "s (" << (pass.seconds > 0 ? pass.ticks / pass.seconds : 0.0) << " ticks/s)  tick mean "
+                      << pass.tick.meanMs << "ms p50 " << pass.tick.p50Ms << "ms p99 " << pass.tick.p99Ms
+                      << "ms max " << pass.tick.maxMs << "ms  checksum " << std::hex << pass.checksum << std::dec
+                      << '\n';
+        }
+    }
+
+    if (diverged)
+    {
+        std::cerr << "Passes ended in different worlds, the replay isn't deterministic\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+struct ReplayOptions
+{
+    /* Written by server --capture */
+    std::string path;
+    /* Simulation threads, the outcome is the same for any count */
+    int threads{1};
+    /* Passes over the capture, each on a fresh server, so timings can settle */
+    int repeat{1};
+    /* One JSON object per pass instead of a table, like bench --json */
+    bool json{false};
+};
+
+/*
+ * Feeds a capture through a server with no sockets and no sleeping: datagrams go straight into its
+ * ingress as they were stamped, and each tick marker runs the tick at its recorded time. Prints tick
+ * timings and a checksum of the final world, which must match between builds that simulate the same.
+ * Returns the process exit code
+ */
+int RunReplay(const ReplayOptions &options);
@@ -0,0 +1,258 @@
+#include "RoomManager.hpp"
+
+static uint64_t EndpointKey(const sockaddr_in &address)
+{
+    return ((uint64_t)address.sin_addr.s_addr << 16) | address.sin_port;
+}
+
+RoomManager::RoomManager(int port, int threads) : mPort(port), mThreadCount(std::max(threads, 1))
+{
+    Shutdown::setup();
+}
+
+void RoomManager::SetBindAddress(const std::string &address)
+{
+    mBindAddress = address;
+}
+
+void RoomManager::SetRoomCapacity(int capacity)
+{
+    mRoomCapacity = std::max(capacity, 1);
+}
+
+void RoomManager::SetInterestRadius(float radius, float exitRadius)
+{
+    std::lock_guard lock(mMutex);
+    mInterestRadius = radius;
+    mInterestExitRadius = exitRadius;
+}
+
+void RoomManager::SetMaxRooms(int maxRooms)
+{
+    mMaxRooms = std::max(maxRooms, 1);
+}
+
+void RoomManager::Run()
+{
+    if (!mSock.Create(mBindAddress.c_str(), mPort))
+    {
+        std::cerr << "Couldn't create socket\n";
+        return;
+    }
+
+    mRunning = true;
+    mLastSweep = Clock::now();
+
+    std::function<void(Datagram * datagrams, int count)> callback =
+        [this](Datagram *datagrams, int count)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Clock::time_point now = Clock::now();
+        for (int i = 0; i < count; i++)
+        {
+            RouteDatagram(datagrams[i], now);
+        }
+    };
+
+    if (!mSock.StartReceiveThread(std::chrono::milliseconds(10), callback))
+    {
+        std::cerr << "Failed to start receive thread\n";
+        return;
+    }
+
+    for (int i = 0; i < mThreadCount; i++)
+    {
+        mThreads.emplace_back(&RoomManager::WorkerMain, this);
+    }
+
+    Shutdown::wait();
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRunning = false;
+    }
+    mWake.notify_all();
+
+    for (auto &thread : mThreads)
+    {
+        thread.join();
+    }
+
+    /* No more ticks, each room's state is safe to read from here */
+    for (auto &[id, room] : mRooms)
+    {
+        room->server->Stop();
+    }
+
+    mSock.Close();
+    std::cout << "Shutting down\n";
+}
+
+void RoomManager::RouteDatagram(Datagram &datagram, Clock::time_point now)
+{
+    MSG type;
+    if (!PeekType(datagram.data, datagram.size, type))
+    {
+        return;
+    }
+
+    uint64_t key = EndpointKey(datagram.address);
+    auto it = mRoutes.find(key);
+
+    if (it == mRoutes.end())
+    {
+        if (type != MSG::CONNECT)
+        {
+            return;
+        }
+
+        std::shared_ptr<Room> room = PlaceClient(now);
+        if (!room)
+        {
+            auto full = Encode(PacketHeader{.type = MSG::DISCONNECT});
+            mSock.SendTo(full.data, full.size, datagram.address);
+            return;
+        }
+
+        room->routes++;
+        it = mRoutes.emplace(key, Route{.room = room, .lastSeen = now}).first;
+    }
+
+    it->second.lastSeen = now;
+    it->second.room->server->Deliver(datagram.data, datagram.size, datagram.address);
+
+    if (type == MSG::DISCONNECT)
+    {
+        it->second.room->routes--;
+        mRoutes.erase(it);
+    }
+}
+
+std::shared_ptr<RoomManager::Room> RoomManager::PlaceClient(Clock::time_point now)
+{
+    /* Fill rooms up rather than spreading players thin, a match needs players */
+    std::shared_ptr<Room> best;
+    for (auto &[id, room] : mRooms)
+    {
+        if (room->routes < mRoomCapacity && (!best || room->routes > best->routes))
+        {
+            best = room;
+        }
+    }
+
+    if (best || mRooms.size() >= mMaxRooms)
+    {
+        return best;
+    }
+
+    auto room = std::make_shared<Room>();
+    room->id = mNextRoomId++;
+    room->server = std::make_unique<Server>(mSock);
+    room->server->SetMaxPlayers(mRoomCapacity);
+    room->server->SetInterestRadius(mInterestRadius, mInterestExitRadius);
+    room->server->Start();
+    room->deadline = now + mTickInterval;
+
+    mRooms.emplace(room->id, room);
+    mSchedule.push({room->deadline, room});
+    mWake.notify_one();
+
+    std::cout << "Room " << room->id << " opened\n";
+    return room;
+}
+
+void RoomManager::SweepRoutes(Clock::time_point now)
+{
+    if (now - mLastSweep < std::chrono::seconds(1))
+    {
+        return;
+    }
+    mLastSweep = now;
+
+    /* The room has timed the client out by now, this only frees its place */
+    std::erase_if(mRoutes, [&](auto &entry)
+                  {
+                      const Route &route = entry.second;
+                      if (now - route.lastSeen < mRouteTimeout)
+                      {
+                          return false;
+                      }
+                      route.room->routes--;
+                      return true; });
+}
+
+void RoomManager::WorkerMain()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (mRunning)
+    {
+        if (mSchedule.empty())
+        {
+            mWake.wait(lock);
+            continue;
+        }
+
+        Due due = mSchedule.top();
+        if (due.deadline > Clock::now())
+        {
+            /* Woken early by a new room with a sooner deadline, or by shutdown */
+            mWake.wait_until(lock, due.deadline);
+            continue;
+        }
+        mSchedule.pop();
+        SweepRoutes(Clock::now());
+        lock.unlock();
+
+        Room &room = *due.room;
+        Clock::time_point start = Clock::now();
+        room.server->Tick();
+        Clock::time_point end = Clock::now();
+
+        lock.lock();
+
+        room.ticks++;
+        room.totalTickTime += end - start;
+        room.maxTickTime = std::max(room.maxTickTime, end - start);
+        room.maxLateness = std::max(room.maxLateness, start - due.deadline);
+
+        bool idle = room.routes == 0 && room.server->PlayerCount() == 0 &&
+                    room.server->GetIngressStats().depth == 0;
+        room.idleTicks = idle ? room.idleTicks + 1 : 0;
+        if (room.idleTicks >= mReapAfterTicks)
+        {
+            std::cout << "Room " << room.id << " closed\n";
+            mRooms.erase(room.id);
+            continue;
+        }
+
+        /* The next deadline follows from the last one, not from when this tick ran, so rooms don't drift */
+        room.deadline += mTickInterval;
+        while (room.deadline <= end)
+        {
+            room.deadline += mTickInterval;
+            room.missedDeadlines++;
+        }
+
+        mSchedule.push({room.deadline, due.room});
+        mWake.notify_one();
+    }
+}
+
+void RoomManager::GetRoomStats(std::vector<RoomStats> &out)
+{
+    using Ms = std::chrono::duration<double, std::milli>;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    out.clear();
+    for (auto &[id, room] : mRooms)
+    {
+        out.push_back({.id = id,
+                       .players = room->server->PlayerCount(),
+                       .ticks = room->ticks,
+                       .missedDeadlines = room->missedDeadlines,
+                       .meanTickMs = room->ticks ? Ms(room->totalTickTime).count() / room->ticks : 0.0,
+                       .maxTickMs = Ms(room->maxTickTime).count(),
+                       .maxLatenessMs = Ms(room->maxLateness).count()});
+    }
+}
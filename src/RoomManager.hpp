@@ -0,0 +1,114 @@
+#pragma once
+#include "Server.hpp"
+#include <unordered_map>
+#include <condition_variable>
+#include <queue>
+
+/*
+ * Many independent matches behind one endpoint. Every room is a hosted Server with its own world,
+ * the receive thread routes datagrams to rooms by sender and a fixed pool of threads ticks them,
+ * earliest deadline first, so a slow room delays the others as little as possible.
+ *
+ * A CONNECT from an unknown endpoint joins the fullest room with space left, or opens a new room.
+ * Routes nobody has sent on for longer than the server's heartbeat are dropped, and a room that has
+ * stayed empty for a while is closed.
+ */
+class RoomManager
+{
+public:
+    struct RoomStats
+    {
+        uint32_t id;
+        size_t players;
+        uint64_t ticks;
+        /* Ticks skipped because the room couldn't start before its next one was due */
+        uint64_t missedDeadlines;
+        double meanTickMs;
+        double maxTickMs;
+        /* Worst delay between a deadline and its tick starting */
+        double maxLatenessMs;
+    };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Room
+    {
+        uint32_t id;
+        std::unique_ptr<Server> server;
+        Clock::time_point deadline;
+        /* Live routes into the room, counts players before their first tick */
+        size_t routes{0};
+        int idleTicks{0};
+        uint64_t ticks{0};
+        uint64_t missedDeadlines{0};
+        Clock::duration totalTickTime{0};
+        Clock::duration maxTickTime{0};
+        Clock::duration maxLateness{0};
+    };
+
+    struct Route
+    {
+        std::shared_ptr<Room> room;
+        Clock::time_point lastSeen;
+    };
+
+    struct Due
+    {
+        Clock::time_point deadline;
+        std::shared_ptr<Room> room;
+
+        bool operator>(const Due &other) const
+        {
+            return deadline > other.deadline;
+        }
+    };
+
+    UdpSocket mSock;
+    int mPort;
+    std::string mBindAddress{"127.0.0.1"};
+    int mThreadCount;
+    size_t mRoomCapacity{16};
+    size_t mMaxRooms{64};
+    float mInterestRadius{DEFAULT_INTEREST_RADIUS};
+    float mInterestExitRadius{DEFAULT_INTEREST_EXIT_RADIUS};
+    int mReapAfterTicks{50};
+    static constexpr std::chrono::milliseconds mTickInterval{100};
+    static constexpr std::chrono::seconds mRouteTimeout{2};
+    uint32_t mNextRoomId{0};
+
+    /* Guards everything below, and every Room field except server */
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    bool mRunning{false};
+    std::unordered_map<uint32_t, std::shared_ptr<Room>> mRooms;
+    std::unordered_map<uint64_t, Route> mRoutes;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> mSchedule;
+    Clock::time_point mLastSweep;
+    std::vector<std::thread> mThreads;
+
+    void RouteDatagram(Datagram &datagram, Clock::time_point now);
+    std::shared_ptr<Room> PlaceClient(Clock::time_point now);
+    void SweepRoutes(Clock::time_point now);
+    void WorkerMain();
+
+public:
+    RoomManager(int port, int threads);
+
+    /* Address Run() binds to, 0.0.0.0 for every interface */
+    void SetBindAddress(const std::string &address);
+
+    /* Players per room, connects beyond it go to another room */
+    void SetRoomCapacity(int capacity);
+
+    /* Connects that would need a room beyond this many are turned away */
+    void SetMaxRooms(int maxRooms);
+
+    /* Every room's interest radii, see Server::SetInterestRadius(). Rooms opened from now on use them */
+    void SetInterestRadius(float radius, float exitRadius);
+
+    /* Thread safe */
+    void GetRoomStats(std::vector<RoomStats> &out);
+
+    void Run();
+};
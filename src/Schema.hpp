@@ -0,0 +1,396 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <bit>
+#include <algorithm>
+#include <type_traits>
+#include "raylib.h"
+
+/*
+ * Bit-packed wire format. Every field is described by a codec that knows its value range, so it is
+ * written with exactly the bits it needs, and a packet's layout is a Schema listing its fields.
+ * Sizes are constexpr: a packet's encoded size is known, and checked, at compile time.
+ *
+ * Values go out least significant bit first. Readers never trust the buffer: running off the end or
+ * reading a value outside a codec's range marks the reader as failed instead of producing garbage.
+ */
+
+class BitWriter
+{
+private:
+    uint8_t *mData;
+    size_t mCapacity;
+    size_t mBitPos{0};
+    bool mOverflow{false};
+
+public:
+    BitWriter(void *data, size_t capacity) : mData(static_cast<uint8_t *>(data)), mCapacity(capacity)
+    {
+        memset(mData, 0, mCapacity);
+    }
+
+    void Write(uint64_t value, int bits)
+    {
+        if (mBitPos + bits > mCapacity * 8)
+        {
+            mOverflow = true;
+            return;
+        }
+
+        while (bits > 0)
+        {
+            int offset = mBitPos & 7;
+            int chunk = std::min(bits, 8 - offset);
+            mData[mBitPos >> 3] |= (uint8_t)((value & ((1u << chunk) - 1)) << offset);
+            value >>= chunk;
+            bits -= chunk;
+            mBitPos += chunk;
+        }
+    }
+
+    size_t BitsWritten() const
+    {
+        return mBitPos;
+    }
+
+    size_t BytesWritten() const
+    {
+        return (mBitPos + 7) / 8;
+    }
+
+    bool Ok() const
+    {
+        return !mOverflow;
+    }
+};
+
+class BitReader
+{
+private:
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mBitPos{0};
+    bool mFailed{false};
+
+public:
+    BitReader(const void *data, size_t size) : mData(static_cast<const uint8_t *>(data)), mSize(size) {}
+
+    uint64_t Read(int bits)
+    {
+        if (mFailed || mBitPos + bits > mSize * 8)
+        {
+            mFailed = true;
+            return 0;
+        }
+
+        uint64_t value = 0;
+        int shift = 0;
+        while (bits > 0)
+        {
+            int offset = mBitPos & 7;
+            int chunk = std::min(bits, 8 - offset);
+            value |= (uint64_t)((mData[mBitPos >> 3] >> offset) & ((1u << chunk) - 1)) << shift;
+            shift += chunk;
+            bits -= chunk;
+            mBitPos += chunk;
+        }
+        return value;
+    }
+
+    void Fail()
+    {
+        mFailed = true;
+    }
+
+    size_t BitsRemaining() const
+    {
+        return mSize * 8 - mBitPos;
+    }
+
+    bool Ok() const
+    {
+        return !mFailed;
+    }
+};
+
+constexpr int BitsFor(uint64_t maxValue)
+{
+    int bits = 1;
+    while (bits < 64 && (maxValue >> bits) != 0)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/* Unsigned integer in [0, Max], larger values are clamped on write */
+template <typename T, uint64_t Max>
+struct UIntCodec
+{
+    using Type = T;
+    static constexpr size_t bits = BitsFor(Max);
+
+    static void Write(BitWriter &writer, const T &value)
+    {
+        writer.Write(std::min<uint64_t>((uint64_t)value, Max), bits);
+    }
+
+    static void Read(BitReader &reader, T &value)
+    {
+        uint64_t raw = reader.Read(bits);
+        if (raw > Max)
+        {
+            reader.Fail();
+        }
+        value = (T)raw;
+    }
+};
+
+template <typename E, int Count>
+struct EnumCodec
+{
+    using Type = E;
+    static constexpr size_t bits = BitsFor(Count - 1);
+
+    static void Write(BitWriter &writer, const E &value)
+    {
+        writer.Write((uint64_t)value, bits);
+    }
+
+    static void Read(BitReader &reader, E &value)
+    {
+        uint64_t raw = reader.Read(bits);
+        if (raw >= (uint64_t)Count)
+        {
+            reader.Fail();
+        }
+        value = (E)raw;
+    }
+};
+
+/* Full precision float, for values without a useful range such as timestamps */
+struct Float32Codec
+{
+    using Type = float;
+    static constexpr size_t bits = 32;
+
+    static void Write(BitWriter &writer, const float &value)
+    {
+        writer.Write(std::bit_cast<uint32_t>(value), bits);
+    }
+
+    static void Read(BitReader &reader, float &value)
+    {
+        value = std::bit_cast<float>((uint32_t)reader.Read(bits));
+    }
+};
+
+/* Float in [Min, Max] stored in steps of 1 / StepsPerUnit, out of range values are clamped */
+template <int Min, int Max, int StepsPerUnit>
+struct QuantizedFloatCodec
+{
+    static_assert(Min < Max && StepsPerUnit > 0);
+
+    using Type = float;
+    static constexpr int min = Min;
+    static constexpr int max = Max;
+    static constexpr int stepsPerUnit = StepsPerUnit;
+    static constexpr uint64_t steps = (uint64_t)(Max - Min) * StepsPerUnit;
+    static constexpr size_t bits = BitsFor(steps);
+
+    static uint64_t ToSteps(float value)
+    {
+        float clamped = std::clamp(value, (float)Min, (float)Max);
+        return std::min<uint64_t>(std::lround((clamped - Min) * StepsPerUnit), steps);
+    }
+
+    static float FromSteps(uint64_t raw)
+    {
+        return Min + (float)raw / StepsPerUnit;
+    }
+
+    /* The value a receiver would decode */
+    static float Quantize(float value)
+    {
+        return FromSteps(ToSteps(value));
+    }
+
+    static void Write(BitWriter &writer, const float &value)
+    {
+        writer.Write(ToSteps(value), bits);
+    }
+
+    static void Read(BitReader &reader, float &value)
+    {
+        uint64_t raw = reader.Read(bits);
+        if (raw > steps)
+        {
+            reader.Fail();
+        }
+        value = FromSteps(raw);
+    }
+};
+
+/* Signed fixed point integer with FractionBits below the point, for a value in [Min, Max]. Exact, out of range values are clamped */
+template <int Min, int Max, int FractionBits>
+struct FixedPointCodec
+{
+    static_assert(Min < Max && FractionBits >= 0);
+
+    using Type = int32_t;
+    static constexpr int64_t min = (int64_t)Min << FractionBits;
+    static constexpr int64_t max = (int64_t)Max << FractionBits;
+    static constexpr size_t bits = BitsFor(max - min);
+
+    static void Write(BitWriter &writer, const int32_t &value)
+    {
+        writer.Write((uint64_t)(std::clamp<int64_t>(value, min, max) - min), bits);
+    }
+
+    static void Read(BitReader &reader, int32_t &value)
+    {
+        uint64_t raw = reader.Read(bits);
+        if (raw > (uint64_t)(max - min))
+        {
+            reader.Fail();
+        }
+        value = (int32_t)(min + (int64_t)raw);
+    }
+};
+
+template <typename XCodec, typename YCodec>
+struct Vector2Codec
+{
+    using Type = Vector2;
+    static constexpr size_t bits = XCodec::bits + YCodec::bits;
+
+    static Vector2 Quantize(Vector2 value)
+    {
+        return {XCodec::Quantize(value.x), YCodec::Quantize(value.y)};
+    }
+
+    static void Write(BitWriter &writer, const Vector2 &value)
+    {
+        XCodec::Write(writer, value.x);
+        YCodec::Write(writer, value.y);
+    }
+
+    static void Read(BitReader &reader, Vector2 &value)
+    {
+        XCodec::Read(reader, value.x);
+        YCodec::Read(reader, value.y);
+    }
+};
+
+template <typename Codec, size_t N>
+struct ArrayCodec
+{
+    using Type = typename Codec::Type[N];
+    static constexpr size_t bits = Codec::bits * N;
+
+    static void Write(BitWriter &writer, const Type &values)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            Codec::Write(writer, values[i]);
+        }
+    }
+
+    static void Read(BitReader &reader, Type &values)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            Codec::Read(reader, values[i]);
+        }
+    }
+};
+
+template <typename T>
+struct MemberTraits;
+
+template <typename Class, typename Member>
+struct MemberTraits<Member Class::*>
+{
+    using ClassType = Class;
+    using MemberType = Member;
+};
+
+/* One field of a struct: which member, and how it goes on the wire */
+template <auto Member, typename Codec>
+struct Field
+{
+    using Owner = typename MemberTraits<decltype(Member)>::ClassType;
+    static_assert(std::is_same_v<typename MemberTraits<decltype(Member)>::MemberType, typename Codec::Type>,
+                  "Codec type doesn't match the member");
+
+    static constexpr size_t bits = Codec::bits;
+
+    static void Write(BitWriter &writer, const Owner &owner)
+    {
+        Codec::Write(writer, owner.*Member);
+    }
+
+    static void Read(BitReader &reader, Owner &owner)
+    {
+        Codec::Read(reader, owner.*Member);
+    }
+};
+
+/* Fields in wire order. A Schema is itself a codec, so structs can nest */
+template <typename T, typename... Fields>
+struct Schema
+{
+    using Type = T;
+    static constexpr size_t bits = (Fields::bits + ... + 0);
+    static constexpr size_t bytes = (bits + 7) / 8;
+
+    static void Write(BitWriter &writer, const T &value)
+    {
+        (Fields::Write(writer, value), ...);
+    }
+
+    static void Read(BitReader &reader, T &value)
+    {
+        (Fields::Read(reader, value), ...);
+    }
+};
+
+/* Specialised next to each packet type with `using Type = Schema<...>` */
+template <typename Packet>
+struct SchemaOf;
+
+template <typename Packet>
+struct Encoded
+{
+    static constexpr size_t capacity = SchemaOf<Packet>::Type::bytes;
+    char data[capacity];
+    size_t size;
+};
+
+/* size is 0 if the packet didn't fit, and sockets don't send empty datagrams */
+template <typename Packet>
+Encoded<Packet> Encode(const Packet &packet)
+{
+    Encoded<Packet> encoded;
+    BitWriter writer(encoded.data, Encoded<Packet>::capacity);
+    SchemaOf<Packet>::Type::Write(writer, packet);
+    encoded.size = writer.Ok() ? writer.BytesWritten() : 0;
+    return encoded;
+}
+
+/* False if the datagram is too short or holds values the schema doesn't allow */
+template <typename Packet>
+bool Decode(const char *buffer, int size, Packet &packet)
+{
+    if (size < (int)SchemaOf<Packet>::Type::bytes)
+    {
+        return false;
+    }
+
+    BitReader reader(buffer, size);
+    SchemaOf<Packet>::Type::Read(reader, packet);
+    return reader.Ok();
+}
@@ -1,107 +1,548 @@
 #include "Server.hpp"
+#include <sstream>
+#include <iomanip>
 
 Server::Server(int port) : mPort(port)
 {
     Shutdown::setup();
+    mShards.push_back(std::make_unique<Shard>());
 };
 
-void Server::Attach()
+Server::Server(UdpSocket &endpoint) : mPort(ntohs(endpoint.mBoundAddress.sin_port))
 {
+    mShards.push_back(std::make_unique<Shard>());
+    mShards[0]->endpoint = &endpoint;
+}
+
+void Server::Attach(NetBackend backend)
+{
+    mBackend = backend;
 
-    if (!mSock.Create("127.0.0.1", mPort))
+    while (mShards.size() < (size_t)mShardCount)
     {
-        std::cerr << "Couldn't create socket\n";
-        return;
+        mShards.push_back(std::make_unique<Shard>());
     }
 
-    std::function<void(char *buffer, int bytesRead, sockaddr_in sender)> callback =
-        [this](char *buffer, int bytesRead, sockaddr_in sender)
+    for (auto &shard : mShards)
     {
-        this->ReceiveMessage(buffer, bytesRead, sender);
-    };
+        if (!shard->socket.Create(mBindAddress.c_str(), mPort, mShards.size() > 1))
+        {
+            std::cerr << "Couldn't create socket\n";
+            return;
+        }
+        shard->socket.SetBatchSize(mBatchSize);
+    }
+
+    /* The program belongs to the port's whole reuseport group, attaching it once is enough */
+    if (mSteerShards && mShards.size() > 1 && !mShards[0]->socket.SteerBySource(mShards.size()))
+    {
+        std::cerr << "Shard steering unavailable, falling back to the kernel's hash\n";
+    }
 
     mRunning = true;
-    if (!mSock.StartReceiveThread(std::chrono::milliseconds(10), callback))
+
+    if (mStatsPort > 0)
     {
-        std::cerr << "Failed to start receive thread\n";
-        return;
+        /* Loopback only whatever the game binds to, the numbers are for whoever runs the server */
+        if (!mStatsSocket.Create("127.0.0.1", mStatsPort) ||
+            !mStatsSocket.StartReceiveThread(std::chrono::milliseconds(100), [this](char *, int, sockaddr_in sender)
+                                             {
+                                                 std::string text = FormatMetrics();
+                                                 mStatsSocket.SendTo(text.data(), text.size(), sender); }))
+        {
+            std::cerr << "Couldn't open the stats port\n";
+        }
+    }
+
+    for (uint32_t index = 0; index < mShards.size(); index++)
+    {
+        std::function<void(Datagram * datagrams, int count)> callback =
+            [this, index](Datagram *datagrams, int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                this->ReceiveMessage(datagrams[i].data, datagrams[i].size, datagrams[i].address, index);
+            }
+        };
+
+        UdpSocket &socket = mShards[index]->socket;
+
+        if (mBackend == NetBackend::EventLoop)
+        {
+            if (!socket.StartReceiving(mLoop, callback))
+            {
+                std::cerr << "Failed to register socket with event loop\n";
+            }
+            continue;
+        }
+
+        if (!socket.StartReceiveThread(std::chrono::milliseconds(10), callback))
+        {
+            std::cerr << "Failed to start receive thread\n";
+            return;
+        }
     }
 }
 
-void Server::Run()
+void Server::Start()
 {
+    if (!mCapturePath.empty())
+    {
+        CaptureHeader header{.magic = {}, .version = CAPTURE_VERSION, .seed = mSeed,
+                             .tickRate = 1e9 / mScheduler.Interval().count(),
+                             .maxPlayers = mMaxPlayers, .shards = (uint32_t)mShards.size(),
+                             .lockstep = mLockstep};
+        memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        std::lock_guard<std::mutex> lock(mCaptureMutex);
+        mCapturing = mCapture.Open(mCapturePath, header);
+    }
 
     CreateDots();
+    if (mLockstep)
+    {
+        mLockstepWorld.Reset(mSeed);
+    }
+    mStartTime = std::chrono::high_resolution_clock::now();
+    mSteadyStart = TickScheduler::Clock::now();
+    mScheduler.Start(mSteadyStart);
+}
 
+void Server::Tick()
+{
     using namespace std::chrono;
-    constexpr milliseconds timeStep(mServerStepMs);
+    TickAt(mTick + 1, duration<double, std::milli>(TickScheduler::Clock::now() - mSteadyStart).count());
+}
 
-    mStartTime = std::chrono::high_resolution_clock::now();
+void Server::RunDue(TickScheduler::Due due)
+{
+    for (uint64_t tick = due.first; tick < due.first + due.count; tick++)
+    {
+        using namespace std::chrono;
+        TickAt(tick, duration<double, std::milli>(mScheduler.Deadline(tick) - mSteadyStart).count());
+    }
+    mMetrics.skipped.Set(mScheduler.Skipped());
+}
+
+void Server::TickAt(uint64_t tick, double time)
+{
+    using namespace std::chrono;
+    auto begin = high_resolution_clock::now();
+    mTick = tick;
+    mTime = time;
+    Step();
 
-    while (mRunning && !Shutdown::should_shutdown())
+    auto end = high_resolution_clock::now();
+    uint64_t nanos = duration_cast<nanoseconds>(end - begin).count();
+    mMetrics.tick.Record(nanos / 1000);
+    mMetrics.ticks.Add(1);
+    if (end - begin > mScheduler.Interval())
     {
-        auto currentTime = high_resolution_clock::now();
-        mTime = duration_cast<milliseconds>(currentTime - mStartTime).count();
-        Step();
+        mMetrics.overruns.Add(1);
+    }
 
-        auto workTime = high_resolution_clock::now() - currentTime;
-        auto sleepTime = timeStep - workTime;
+    if (mStatsInterval > seconds(0) && steady_clock::now() >= mNextStatsDump)
+    {
+        mNextStatsDump = steady_clock::now() + mStatsInterval;
+        std::cout << FormatMetrics() << std::flush;
+    }
 
-        if (sleepTime > nanoseconds(0))
-        {
-            std::this_thread::sleep_for(sleepTime);
-        }
+    mTicks++;
+    mTickNanos += nanos;
+    uint64_t max = mMaxTickNanos.load();
+    while (nanos > max && !mMaxTickNanos.compare_exchange_weak(max, nanos))
+    {
+    }
+}
+
+void Server::SetTickRate(double hz)
+{
+    mScheduler.SetRate(hz);
+}
+
+void Server::SetOverrunPolicy(TickScheduler::OverrunPolicy policy, int maxCatchUp)
+{
+    mScheduler.SetPolicy(policy, maxCatchUp);
+}
+
+void Server::SetTickSpin(std::chrono::microseconds spin)
+{
+    mScheduler.SetSpin(spin);
+}
+
+void Server::SetStatsPort(int port)
+{
+    mStatsPort = port;
+}
+
+void Server::SetStatsInterval(int seconds)
+{
+    mStatsInterval = std::chrono::seconds(std::max(seconds, 0));
+    mNextStatsDump = std::chrono::steady_clock::now() + mStatsInterval;
+}
+
+std::string Server::FormatMetrics() const
+{
+    static const char *phaseNames[PHASE_COUNT] = {"input_drain", "heartbeat", "collisions", "snapshot_build", "broadcast"};
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+
+    auto histogram = [&](const std::string &name, const Histogram &histogram)
+    {
+        Histogram::Summary summary = histogram.Summarize();
+        out << name << "_ms.mean " << summary.meanMs << '\n'
+            << name << "_ms.p50 " << summary.p50Ms << '\n'
+            << name << "_ms.p99 " << summary.p99Ms << '\n'
+            << name << "_ms.max " << summary.maxMs << '\n';
+    };
+
+    size_t clients = PlayerCount();
+    out << "clients " << clients << '\n'
+        << "ticks " << mMetrics.ticks.Load() << '\n'
+        << "tick_overruns " << mMetrics.overruns.Load() << '\n'
+        << "ticks_skipped " << mMetrics.skipped.Load() << '\n';
+    histogram("tick", mMetrics.tick);
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        histogram(std::string("phase.") + phaseNames[phase], mMetrics.phases[phase]);
     }
 
-    PacketHeader packet = {.type = MSG::DISCONNECT};
-    for (auto &[address, info] : mClients)
+    uint64_t packetsIn = 0, bytesIn = 0;
+    for (size_t shard = 0; shard < mShards.size(); shard++)
     {
-        mSock.SendTo(&packet, sizeof(PacketHeader), address);
+        packetsIn += mShards[shard]->packetsIn.Load();
+        bytesIn += mShards[shard]->bytesIn.Load();
+        out << "shard." << shard << ".packets_in " << mShards[shard]->packetsIn.Load() << '\n'
+            << "shard." << shard << ".ingress_depth " << mShards[shard]->ingress.size() << '\n';
     }
 
-    mSock.Close();
-    std::cout << "Shutting down\n";
+    IngressStats ingress = GetIngressStats();
+    out << "packets_in " << packetsIn << '\n'
+        << "bytes_in " << bytesIn << '\n'
+        << "packets_out " << mMetrics.packetsOut.Load() << '\n'
+        << "bytes_out " << mMetrics.bytesOut.Load() << '\n'
+        << "send_drops " << mMetrics.sendDrops.Load() << '\n'
+        << "ingress_depth " << ingress.depth << '\n'
+        << "ingress_overflows " << ingress.overflows << '\n'
+        << "input_depth.max " << mMetrics.inputDepthMax.Load() << '\n'
+        << "input_depth.mean " << (clients ? (double)mMetrics.inputDepthTotal.Load() / clients : 0.0) << '\n';
+    return out.str();
+}
+
+Server::TickStats Server::TakeTickStats()
+{
+    uint64_t ticks = mTicks.exchange(0);
+    uint64_t nanos = mTickNanos.exchange(0);
+    uint64_t max = mMaxTickNanos.exchange(0);
+    return {.ticks = ticks,
+            .meanTickMs = ticks ? nanos / 1e6 / ticks : 0.0,
+            .maxTickMs = max / 1e6};
 }
 
-void Server::ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender)
+void Server::Stop()
 {
+    auto packet = Encode(PacketHeader{.type = MSG::DISCONNECT});
+    Broadcast(packet.data, packet.size);
+}
+
+void Server::Deliver(char *buffer, int bytesRead, sockaddr_in sender)
+{
+    ReceiveMessage(buffer, bytesRead, sender, 0);
+}
+
+size_t Server::PlayerCount() const
+{
+    return mPlayerCount.load(std::memory_order_relaxed);
+}
+
+void Server::Run()
+{
+    Start();
+
+    if (mBackend == NetBackend::EventLoop)
+    {
+        /*
+         * Socket and tick timer share this thread, a signal interrupts the wait and is seen on the next
+         * tick. The timer is periodic, so it doesn't drift either, but it keeps the rate it was armed with.
+         * Tick 0 moves to the timer's first expiry so it isn't counted as overrun.
+         */
+        mScheduler.Start(TickScheduler::Clock::now() + mScheduler.Interval());
+        mLoop.AddTimer(mScheduler.Interval(), [this](uint64_t)
+                       {
+                           if (!mRunning || Shutdown::should_shutdown())
+                           {
+                               mLoop.Stop();
+                               return;
+                           }
+
+                           RunDue(mScheduler.Poll(TickScheduler::Clock::now())); });
+        mLoop.Run();
+    }
+
+    while (mBackend == NetBackend::Thread && mRunning && !Shutdown::should_shutdown())
+    {
+        RunDue(mScheduler.Wait());
+    }
 
-    std::lock_guard<std::mutex> lock(mMutex);
-    auto packet = reinterpret_cast<PacketHeader *>(buffer);
+    Stop();
+
+    for (auto &shard : mShards)
+    {
+        shard->socket.Close();
+    }
+    mStatsSocket.Close();
 
-    if (mClients.find(sender) == mClients.end() && packet->type == MSG::CONNECT)
+    if (mCapturing)
     {
-        mClients[sender] = ClientInfo{.lastCheckIn = 0, .id = ntohs(sender.sin_port)};
-        PacketHeader p1;
-        p1.type = MSG::CONNECT;
-        mSock.SendTo(&p1, sizeof(PacketHeader), sender);
+        std::lock_guard<std::mutex> lock(mCaptureMutex);
+        mCapturing = false;
+        mCapture.Close();
+    }
+    std::cout << "Shutting down\n";
+}
 
-        DotUpdatePacket p2;
-        memcpy(&p2.positions, mDots, sizeof(Vector2) * DOT_COUNT);
-        mSock.SendTo(&p2, sizeof(DotUpdatePacket), sender);
+void Server::ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender, uint32_t shard)
+{
+    using namespace std::chrono;
+    float arrival = duration<float, std::milli>(high_resolution_clock::now() - mStartTime).count();
 
-        TimeSyncPacket p3;
-        p3.startTimeNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                                mStartTime.time_since_epoch())
-                                .count();
-        mSock.SendTo(&p3, sizeof(TimeSyncPacket), sender);
+    /*
+     * Queued while holding the capture, so a datagram is recorded before the marker of the tick that
+     * drains it and replay splits traffic between ticks exactly as it was
+     */
+    if (mCapturing && bytesRead > 0 && bytesRead <= UINT16_MAX)
+    {
+        std::lock_guard<std::mutex> lock(mCaptureMutex);
+        mCapture.WriteDatagram(buffer, bytesRead, sender.sin_addr.s_addr, sender.sin_port, shard, arrival);
+        Ingest(buffer, bytesRead, sender, shard, arrival);
+        return;
+    }
+
+    Ingest(buffer, bytesRead, sender, shard, arrival);
+}
+
+void Server::SetKnown(const sockaddr_in &address, bool known)
+{
+    std::unique_lock lock(mKnownMutex);
+    if (known)
+    {
+        mKnownEndpoints.insert(ClientTable::Key(address));
     }
     else
     {
-        mClients[sender].lastCheckIn = 0;
+        mKnownEndpoints.erase(ClientTable::Key(address));
+    }
+}
+
+void Server::Ingest(const char *buffer, int bytesRead, sockaddr_in sender, uint32_t shard, float arrival)
+{
+    IngressEvent event{.type = MSG::CONNECT, .sender = sender, .firstSequence = 0, .inputCount = 0, .inputs = {},
+                       .snapshotId = 0, .arrival = arrival};
+    mShards[shard]->packetsIn.Add(1);
+    mShards[shard]->bytesIn.Add(bytesRead);
+
+    if (!PeekType(buffer, bytesRead, event.type))
+    {
+        return;
+    }
+
+    /*
+     * Answered right here, waiting for the tick would add its queueing to the round trip. Only for
+     * connected clients, and pings are padded to the pong's size, so spoofed senders can't use the
+     * server to reflect or amplify traffic
+     */
+    if (event.type == MSG::TIME_PING)
+    {
+        TimePingPacket ping;
+        if (mOffline || !Decode(buffer, bytesRead, ping))
+        {
+            return;
+        }
+        {
+            std::shared_lock lock(mKnownMutex);
+            if (!mKnownEndpoints.contains(ClientTable::Key(sender)))
+            {
+                return;
+            }
+        }
+
+        TimePongPacket pong;
+        pong.clientSend = ping.clientSend;
+        pong.serverReceive = ServerMicros();
+        pong.serverSend = ServerMicros();
+        auto encoded = Encode(pong);
+        mShards[shard]->endpoint->SendTo(encoded.data, encoded.size, sender);
+        return;
+    }
+
+    if (event.type == MSG::PLAYER_UPDATE)
+    {
+        PlayerUpdatePacket packet;
+        if (!Decode(buffer, bytesRead, packet))
+        {
+            return;
+        }
+
+        /* An entry sent at frame S holds frames S - 9 through S, each at its frame number modulo the size */
+        uint64_t last = packet.entry.sequenceNum;
+        event.firstSequence = last >= INPUT_BUFFER_SIZE - 1 ? last - (INPUT_BUFFER_SIZE - 1) : 0;
+        event.inputCount = last - event.firstSequence + 1;
+        for (uint16_t i = 0; i < event.inputCount; i++)
+        {
+            event.inputs[i] = packet.entry.input[(event.firstSequence + i) % INPUT_BUFFER_SIZE];
+        }
+    }
+    else if (event.type == MSG::INPUT_WINDOW)
+    {
+        size_t count;
+        if (!DecodeInputWindow(buffer, bytesRead, event.firstSequence, event.inputs, count))
+        {
+            return;
+        }
+        event.inputCount = count;
+    }
+    else if (event.type == MSG::SNAPSHOT_ACK)
+    {
+        SnapshotAckPacket packet;
+        if (!Decode(buffer, bytesRead, packet))
+        {
+            return;
+        }
+        event.snapshotId = packet.snapshotId;
+    }
+    else if (event.type == MSG::FRAME_ACK)
+    {
+        FrameAckPacket packet;
+        if (!Decode(buffer, bytesRead, packet))
+        {
+            return;
+        }
+        event.snapshotId = packet.nextFrame;
+    }
+
+    /* A full queue drops the datagram, same as the kernel would if we never read it */
+    mShards[shard]->ingress.Push(event);
+}
+
+void Server::DrainIngress()
+{
+    /*
+     * The tick's marker is written with the capture held until every queue is drained, so receive
+     * threads can't record a datagram after the marker that this tick still drains
+     */
+    std::unique_lock<std::mutex> capture(mCaptureMutex, std::defer_lock);
+    if (mCapturing)
+    {
+        capture.lock();
+        mCapture.WriteTick(mTick, mTime);
+    }
+
+    for (uint32_t shard = 0; shard < mShards.size(); shard++)
+    {
+        DrainShard(shard);
+    }
+}
+
+void Server::DrainShard(uint32_t shard)
+{
+    IngressEvent event;
+    SendQueue &outbox = mShards[shard]->outbox;
+
+    while (mShards[shard]->ingress.Pop(event))
+    {
+        ClientInfo *client = mClients.Find(event.sender);
 
-        switch (packet->type)
+        if (client == nullptr)
+        {
+            if (event.type != MSG::CONNECT)
+            {
+                continue;
+            }
+
+            if ((int)mClients.size() >= (mLockstep ? std::min(mMaxPlayers, LOCKSTEP_MAX_PLAYERS) : mMaxPlayers))
+            {
+                auto full = Encode(PacketHeader{.type = MSG::DISCONNECT});
+                outbox.Push(full.data, full.size, event.sender);
+                continue;
+            }
+
+            ClientInfo &joined = mClients.Insert(event.sender, ClientInfo{.lastCheckIn = 0, .id = ntohs(event.sender.sin_port)});
+            SetKnown(event.sender, true);
+            joined.shard = shard;
+            mWorld.Reserve(mClients.SlotCapacity());
+            mWorld.Reset(joined.slot, {0, 0}, 10);
+            auto p1 = Encode(PacketHeader{.type = MSG::CONNECT});
+            outbox.Push(p1.data, p1.size, event.sender);
+
+            DotUpdatePacket dots;
+            memcpy(&dots.positions, mDots, sizeof(Vector2) * DOT_COUNT);
+            auto p2 = Encode(dots);
+            outbox.Push(p2.data, p2.size, event.sender);
+
+            TimeSyncPacket timeSync;
+            timeSync.serverTime = (uint64_t)std::llround(mTime * 1000.0);
+            auto p3 = Encode(timeSync);
+            outbox.Push(p3.data, p3.size, event.sender);
+            continue;
+        }
+
+        client->lastCheckIn = 0;
+
+        switch (event.type)
         {
         case MSG::DISCONNECT:
         {
-            mClients.erase(sender);
+            if (client->simulated)
+            {
+                mLockstepLeaves.push_back({.id = client->id, .lastInput = client->lastInput});
+            }
+            mClients.Erase(event.sender);
+            SetKnown(event.sender, false);
             std::cout << "Client disconnected\n";
             break;
         }
         case MSG::PLAYER_UPDATE:
+        case MSG::INPUT_WINDOW:
+        {
+            /* The newest input was sampled as it was sent, each older one a frame before */
+            for (uint16_t i = 0; i < event.inputCount; i++)
+            {
+                uint64_t sequence = event.firstSequence + i;
+
+                /*
+                 * Resent until acknowledged, not late, and an older entry already waiting to be played
+                 * is the window's redundancy rather than a duplicate. Only the newest entry is new to
+                 * every window, so it alone repeating means the datagram itself was duplicated
+                 */
+                if (sequence < client->processedInputs ||
+                    (i + 1 < event.inputCount && client->inputs.Holds(sequence)))
+                {
+                    continue;
+                }
+
+                float sampled = event.arrival - (event.inputCount - 1 - i) * INPUT_FRAME_INTERVAL_MS;
+                client->inputs.Insert(sequence, event.inputs[i], sampled);
+            }
+            break;
+        }
+        case MSG::SNAPSHOT_ACK:
+        {
+            /* Acks can arrive out of order, only ever move the baseline forward */
+            uint32_t acked = client->ackedSnapshot;
+            if (acked == NO_BASELINE || (int32_t)(event.snapshotId - acked) > 0)
+            {
+                client->ackedSnapshot = event.snapshotId;
+            }
+            break;
+        }
+        case MSG::FRAME_ACK:
         {
-            auto data = reinterpret_cast<PlayerUpdatePacket *>(buffer);
-            mClients[sender].inputQueue.push(data->entry);
+            /* Asking for the world again always goes through, otherwise only move forward */
+            uint32_t next = event.snapshotId;
+            if (next == NO_FRAME || client->nextFrame == NO_FRAME || next > client->nextFrame)
+            {
+                client->nextFrame = next;
+            }
             break;
         }
         default:
@@ -110,145 +551,873 @@ void Server::ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender)
     }
 }
 
+Server::IngressStats Server::GetIngressStats() const
+{
+    IngressStats stats{.depth = 0, .capacity = 0, .overflows = 0};
+    for (const auto &shard : mShards)
+    {
+        stats.depth += shard->ingress.size();
+        stats.capacity += shard->ingress.capacity();
+        stats.overflows += shard->ingress.overflows();
+    }
+    return stats;
+}
+
+void Server::GetInputStats(std::vector<ClientInputStats> &out)
+{
+    out.clear();
+    for (auto &[address, client] : mClients)
+    {
+        out.push_back({.id = client.id, .inputs = client.inputs.GetStats()});
+    }
+}
+
 void Server::Step()
 {
+    /* Time since the last lap is charged to a phase, input draining happens in two stretches */
+    using Clock = std::chrono::steady_clock;
+    Clock::duration spent[PHASE_COUNT] = {};
+    auto mark = Clock::now();
+    auto lap = [&](Phase phase)
+    {
+        auto now = Clock::now();
+        spent[phase] += now - mark;
+        mark = now;
+    };
+
+    const uint64_t heartBeatCutoff = std::max<uint64_t>(mHeartbeatTimeout / mScheduler.Interval(), 1);
+    DrainIngress();
+    lap(PHASE_INPUT_DRAIN);
 
-    const int heartBeatCutoff = 10;
-    std::lock_guard<std::mutex> lock(mMutex);
-    for (auto it = mClients.begin(); it != mClients.end();)
+    for (size_t i = 0; i < mClients.size();)
     {
-        if (it->second.lastCheckIn++ > heartBeatCutoff)
+        auto &[address, client] = mClients.at(i);
+        if (client.lastCheckIn++ > heartBeatCutoff)
         {
-            PacketHeader disconnectPacket = {.type = MSG::DISCONNECT};
-            mSock.SendTo(&disconnectPacket, sizeof(PacketHeader), it->first);
-            it = mClients.erase(it);
+            auto disconnectPacket = Encode(PacketHeader{.type = MSG::DISCONNECT});
+            mShards[client.shard]->outbox.Push(disconnectPacket.data, disconnectPacket.size, address);
+            if (client.simulated)
+            {
+                mLockstepLeaves.push_back({.id = client.id, .lastInput = client.lastInput});
+            }
+            /* The last client moves into slot i, check it next */
+            SetKnown(address, false);
+            mClients.EraseAt(i);
             std::cout << "Client disconnected\n";
         }
         else
         {
-            ++it;
+            ++i;
+        }
+    }
+    lap(PHASE_HEARTBEAT);
+
+    /*
+     * Every tick plays a tick's worth of each client's frames, the fraction left over carries to the
+     * next tick. Inputs are applied in rounds of up to INPUT_BUFFER_SIZE per client, the store applying
+     * each round at once. Rounds past the tick's share only drain clients whose buffer has grown past
+     * its target, so a burst catches up instead of adding latency.
+     */
+    mInputBudget += std::chrono::duration<double, std::milli>(mScheduler.Interval()).count() / INPUT_FRAME_INTERVAL_MS;
+    const size_t due = (size_t)mInputBudget;
+    mInputBudget -= due;
+
+    const int maxRounds = mLockstep ? 0 : 10;
+    for (int round = 0; round < maxRounds; round++)
+    {
+        const size_t played = round * INPUT_BUFFER_SIZE;
+        const size_t share = due > played ? std::min<size_t>(INPUT_BUFFER_SIZE, due - played) : 0;
+        bool pending = false;
+
+        for (auto &[address, client] : mClients)
+        {
+            uint8_t input;
+            uint64_t sequence;
+            for (size_t row = 0; row < INPUT_BUFFER_SIZE; row++)
+            {
+                bool catchUp = client.inputs.Depth() > client.inputs.TargetDepth();
+                if ((row >= share && !catchUp) || !client.inputs.Pop(input, sequence))
+                {
+                    break;
+                }
+
+                mWorld.InputRow(row)[client.slot] = input;
+                client.processedInputs = sequence + 1;
+                pending = true;
+            }
+        }
+
+        if (!pending)
+        {
+            break;
         }
+        IntegrateInputs();
     }
 
-    WorldUpdatePacket packet;
-    packet.time = mTime;
+    if (mLockstep)
+    {
+        StepLockstep(due);
+        lap(PHASE_COLLISIONS);
+    }
 
-    int i = 0;
+    size_t depthTotal = 0, depthMax = 0;
     for (auto &[address, client] : mClients)
     {
-        int inputsProcessed = 0;
-        const int maxInputsPerFrame = 10;
-        while (!client.inputQueue.empty() && inputsProcessed < maxInputsPerFrame)
+        depthTotal += client.inputs.Depth();
+        depthMax = std::max(depthMax, client.inputs.Depth());
+    }
+    mMetrics.inputDepthTotal.Set(depthTotal);
+    mMetrics.inputDepthMax.Set(depthMax);
+    lap(PHASE_INPUT_DRAIN);
+
+    if (mLockstep)
+    {
+        SendLockstep();
+        lap(PHASE_SNAPSHOT_BUILD);
+    }
+    else
+    {
+        /* Quantized as it goes out, so deltas only flag moves a client can see */
+        mSnapshot.clear();
+        for (auto &[address, client] : mClients)
         {
-            const InputEntry &entry = client.inputQueue.top();
+            mSnapshot.push_back({.id = client.id,
+                                 .position = WorldPositionCodec::Quantize(mWorld.Position(client.slot)),
+                                 .radius = mWorld.radius[client.slot]});
+        }
+        lap(PHASE_SNAPSHOT_BUILD);
 
-            if (entry.sequenceNum <= client.lastProcessedSequence)
+        CheckPlayerCollisions();
+        CheckDotCollisions();
+        lap(PHASE_COLLISIONS);
+
+        BroadcastSnapshot();
+        lap(PHASE_SNAPSHOT_BUILD);
+    }
+
+    FlushShards();
+    lap(PHASE_BROADCAST);
+    mPlayerCount.store(mClients.size(), std::memory_order_relaxed);
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        mMetrics.phases[phase].Record(std::chrono::duration_cast<std::chrono::microseconds>(spent[phase]).count());
+    }
+}
+
+void Server::FlushShards()
+{
+    for (auto &shard : mShards)
+    {
+        const size_t queued = shard->outbox.size();
+        mMetrics.bytesOut.Add(shard->outbox.bytes());
+        if (mOffline)
+        {
+            mMetrics.packetsOut.Add(queued);
+            shard->outbox.clear();
+            continue;
+        }
+        const size_t sent = shard->endpoint->Flush(shard->outbox);
+        mMetrics.packetsOut.Add(sent);
+        mMetrics.sendDrops.Add(queued - sent);
+    }
+}
+
+void Server::BroadcastSnapshot()
+{
+    std::sort(mSnapshot.begin(), mSnapshot.end(), [](const PlayerState &a, const PlayerState &b)
+              { return a.id < b.id; });
+
+    const uint32_t snapshotId = mSnapshotId++;
+
+    mInterestGrid.Clear();
+    for (size_t i = 0; i < mSnapshot.size(); i++)
+    {
+        mInterestGrid.Insert(i, mSnapshot[i].position);
+    }
+
+    const size_t clientsPerBatch = 32;
+    const size_t batchCount = (mClients.size() + clientsPerBatch - 1) / clientsPerBatch;
+    if (mBatches.size() < batchCount)
+    {
+        mBatches.resize(batchCount);
+    }
+
+    /* Every client is touched by exactly one batch, and everything else is only read */
+    mPool->ParallelFor(batchCount, [&](size_t index, size_t worker)
+                       {
+        WorkerScratch &scratch = mScratch[worker];
+        EncodedBatch &batch = mBatches[index];
+        batch.data.clear();
+        batch.sizes.clear();
+        batch.fragmentCounts.clear();
+
+        size_t end = std::min(mClients.size(), (index + 1) * clientsPerBatch);
+        for (size_t dense = index * clientsPerBatch; dense < end; dense++)
+        {
+            ClientInfo &client = mClients.at(dense).client;
+            const InterestSet *previous = client.sentInterest.empty() ? nullptr : &client.sentInterest.back();
+            UpdateInterest(client, previous, scratch);
+
+            const Snapshot *base = FindSnapshot(client.ackedSnapshot);
+            const InterestSet *baseView = nullptr;
+            for (size_t i = 0; base && i < client.sentInterest.size(); i++)
             {
-                client.inputQueue.pop();
-                continue;
+                if (client.sentInterest.at(i).snapshotId == base->id)
+                {
+                    baseView = &client.sentInterest.at(i);
+                }
             }
 
-            for (auto &input : entry.input)
+            size_t before = batch.sizes.size();
+            if (baseView)
             {
-                ApplyInput(&client.position, input, client.radius);
+                EncodeSnapshot(scratch, batch, snapshotId, base->id, &base->players, &baseView->ids,
+                               client.processedInputs);
             }
+            else
+            {
+                EncodeSnapshot(scratch, batch, snapshotId, NO_BASELINE, nullptr, nullptr, client.processedInputs);
+            }
+            batch.fragmentCounts.push_back(batch.sizes.size() - before);
 
-            client.lastProcessedSequence = entry.sequenceNum;
+            /*
+             * Into the slot being dropped, keeping its capacity. Views change size from tick to tick, so
+             * one that has to grow is sized for the whole room and a warm tick doesn't allocate
+             */
+            InterestSet &sent = client.sentInterest.push_slot();
+            sent.snapshotId = snapshotId;
+            if (sent.ids.capacity() < scratch.view.size())
+            {
+                sent.ids.reserve(mSnapshot.size());
+            }
+            sent.ids.assign(scratch.view.begin(), scratch.view.end());
+        } });
 
-            client.inputQueue.pop();
-            inputsProcessed++;
+    /* The send queue belongs to this thread, queue in client order */
+    for (size_t index = 0; index < batchCount; index++)
+    {
+        const EncodedBatch &batch = mBatches[index];
+        size_t offset = 0, fragment = 0;
+
+        for (size_t i = 0; i < batch.fragmentCounts.size(); i++)
+        {
+            const auto &[address, client] = mClients.at(index * clientsPerBatch + i);
+            SendQueue &outbox = mShards[client.shard]->outbox;
+            for (size_t k = 0; k < batch.fragmentCounts[i]; k++, fragment++)
+            {
+                outbox.Push(&batch.data[offset], batch.sizes[fragment], address);
+                offset += batch.sizes[fragment];
+            }
         }
+    }
+
+    Snapshot &history = mHistory.push_slot();
+    history.id = snapshotId;
+    history.players.assign(mSnapshot.begin(), mSnapshot.end());
+}
 
-        const size_t maxQueueSize = 100;
+void Server::UpdateInterest(const ClientInfo &client, const InterestSet *previous, WorkerScratch &scratch)
+{
+    std::vector<int> &view = scratch.view;
+    view.clear();
+    view.push_back(client.id);
+
+    /* Players already in view only drop out past the exit radius, so ones near the edge don't flicker */
+    const float enter = mInterestRadius * mInterestRadius;
+    const float exit = mInterestExitRadius * mInterestExitRadius;
 
-        while (client.inputQueue.size() > maxQueueSize)
+    scratch.candidates.clear();
+    const Vector2 position = mWorld.Position(client.slot);
+    mInterestGrid.Query(position, mInterestExitRadius, scratch.candidates, scratch.visited);
+
+    for (uint32_t i : scratch.candidates)
+    {
+        const PlayerState &other = mSnapshot[i];
+        if (other.id == client.id)
         {
-            client.inputQueue.pop();
+            continue;
         }
 
-        packet.playerIds[i] = client.id;
-        packet.playerRadius[i] = client.radius;
-        packet.playerPositions[i++] = client.position;
+        float dx = other.position.x - position.x;
+        float dy = other.position.y - position.y;
+        float distance = dx * dx + dy * dy;
+
+        if (distance <= enter ||
+            (distance <= exit && previous && std::binary_search(previous->ids.begin(), previous->ids.end(), other.id)))
+        {
+            view.push_back(other.id);
+        }
     }
 
-    packet.playerCount = mClients.size();
+    std::sort(view.begin(), view.end());
+}
 
-    CheckPlayerCollisions();
-    CheckDotCollisions();
+const Server::Snapshot *Server::FindSnapshot(uint32_t id) const
+{
+    if (id == NO_BASELINE)
+    {
+        return nullptr;
+    }
 
-    Broadcast(&packet, sizeof(WorldUpdatePacket));
+    for (size_t i = 0; i < mHistory.size(); i++)
+    {
+        if (mHistory.at(i).id == id)
+        {
+            return &mHistory.at(i);
+        }
+    }
+    return nullptr;
 }
 
-void Server::Broadcast(void *data, int size)
+static const PlayerState *FindState(const std::vector<PlayerState> &players, int id)
 {
-    for (auto &[address, client] : mClients)
+    auto it = std::lower_bound(players.begin(), players.end(), id, [](const PlayerState &state, int id)
+                               { return state.id < id; });
+    return it != players.end() && it->id == id ? &*it : nullptr;
+}
+
+/* Appends the snapshot for scratch.view to batch, one entry in batch.sizes per fragment */
+void Server::EncodeSnapshot(WorkerScratch &scratch, EncodedBatch &batch, uint32_t snapshotId, uint32_t baselineId,
+                            const std::vector<PlayerState> *baseline, const std::vector<int> *baselineView,
+                            uint64_t processedInputs)
+{
+    const std::vector<int> &view = scratch.view;
+    std::vector<DeltaEntry> &deltas = scratch.deltas;
+    std::vector<size_t> &fragmentStarts = scratch.fragmentStarts;
+    deltas.clear();
+
+    /* Both views are sorted by id, walk them together */
+    size_t i = 0, j = 0;
+    const size_t baselineCount = baselineView ? baselineView->size() : 0;
+
+    while (i < view.size() || j < baselineCount)
+    {
+        if (i == view.size() || (j < baselineCount && (*baselineView)[j] < view[i]))
+        {
+            deltas.push_back({DELTA_REMOVED, PlayerState{.id = (*baselineView)[j++], .position = {}, .radius = 0}});
+            continue;
+        }
+
+        const PlayerState *current = FindState(mSnapshot, view[i]);
+        const PlayerState *previous = nullptr;
+
+        if (j < baselineCount && (*baselineView)[j] == view[i])
+        {
+            previous = FindState(*baseline, (*baselineView)[j++]);
+        }
+        i++;
+
+        if (current == nullptr)
+        {
+            continue;
+        }
+
+        uint8_t flags = DELTA_POSITION | DELTA_RADIUS;
+        if (previous)
+        {
+            flags = 0;
+            if (current->position.x != previous->position.x || current->position.y != previous->position.y)
+            {
+                flags |= DELTA_POSITION;
+            }
+            if (current->radius != previous->radius)
+            {
+                flags |= DELTA_RADIUS;
+            }
+        }
+
+        if (flags)
+        {
+            deltas.push_back({flags, *current});
+        }
+    }
+
+    /* Split into fragments first, every header carries the fragment count */
+    const size_t headerBits = SchemaOf<WorldUpdatePacket>::Type::bits;
+    size_t bits = headerBits;
+
+    fragmentStarts.clear();
+    fragmentStarts.push_back(0);
+    for (size_t entry = 0; entry < deltas.size(); entry++)
     {
-        mSock.SendTo(data, size, address);
+        size_t entryBits = DeltaEntryBits(deltas[entry].flags);
+        if (bits + entryBits > MAX_DATAGRAM_SIZE * 8)
+        {
+            fragmentStarts.push_back(entry);
+            bits = headerBits;
+        }
+        bits += entryBits;
+    }
+
+    const size_t fragmentCount = fragmentStarts.size();
+    fragmentStarts.push_back(deltas.size());
+
+    WorldUpdatePacket header;
+    header.snapshotId = snapshotId;
+    header.baselineId = baselineId;
+    header.time = (uint64_t)std::llround(mTime * 1000.0);
+    header.processedInputs = processedInputs;
+    header.fragmentCount = fragmentCount;
+
+    for (size_t fragment = 0; fragment < fragmentCount; fragment++)
+    {
+        size_t first = fragmentStarts[fragment], last = fragmentStarts[fragment + 1];
+        size_t offset = batch.data.size();
+        batch.data.resize(offset + MAX_DATAGRAM_SIZE);
+        BitWriter writer(&batch.data[offset], MAX_DATAGRAM_SIZE);
+
+        header.fragmentIndex = fragment;
+        header.entryCount = last - first;
+        SchemaOf<WorldUpdatePacket>::Type::Write(writer, header);
+
+        for (size_t entry = first; entry < last; entry++)
+        {
+            WriteDeltaEntry(writer, deltas[entry].flags, deltas[entry].state);
+        }
+
+        batch.data.resize(offset + writer.BytesWritten());
+        batch.sizes.push_back(writer.BytesWritten());
     }
 }
 
-void Server::CheckPlayerCollisions()
+void Server::Broadcast(void *data, int size)
 {
-    for (auto &[id1, player1] : mClients)
+    for (uint32_t shard = 0; shard < mShards.size(); shard++)
     {
-        for (auto &[id2, player2] : mClients)
+        mBroadcastAddresses.clear();
+        for (auto &[address, client] : mClients)
         {
-            if (player1.id == player2.id)
+            if (client.shard == shard)
             {
-                continue;
+                mBroadcastAddresses.push_back(address);
             }
+        }
+
+        size_t sent = mBroadcastAddresses.size();
+        if (!mOffline && !mBroadcastAddresses.empty())
+        {
+            sent = std::max(mShards[shard]->endpoint->SendToMany(data, size, mBroadcastAddresses.data(), mBroadcastAddresses.size()), 0);
+            mMetrics.sendDrops.Add(mBroadcastAddresses.size() - sent);
+        }
+        mMetrics.packetsOut.Add(sent);
+        mMetrics.bytesOut.Add(sent * size);
+    }
+}
 
-            if (Vector2Distance(player1.position, player2.position) < player1.radius)
+void Server::SetMaxPlayers(int maxPlayers)
+{
+    mMaxPlayers = std::max(maxPlayers, 1);
+}
+
+void Server::SetInterestRadius(float radius, float exitRadius)
+{
+    mInterestRadius = std::max(radius, 0.0f);
+    mInterestExitRadius = std::max(exitRadius, mInterestRadius);
+}
+
+void Server::SetWorkerThreads(int threads)
+{
+    mPool = std::make_unique<WorkerPool>(std::max(threads, 1));
+    mScratch.assign(mPool->size(), WorkerScratch{});
+}
+
+void Server::SetSeed(uint32_t seed)
+{
+    mSeed = seed;
+    mRandom.SetState(seed);
+}
+
+void Server::SetLockstep(bool lockstep)
+{
+    mLockstep = lockstep;
+}
+
+void Server::SetCapture(const std::string &path)
+{
+    mCapturePath = path;
+}
+
+void Server::SetBindAddress(const std::string &address)
+{
+    mBindAddress = address;
+}
+
+void Server::SetShards(int shards, bool steer)
+{
+    mShardCount = std::max(shards, 1);
+    mSteerShards = steer;
+}
+
+void Server::SetBatchSize(int batchSize)
+{
+    mBatchSize = batchSize;
+    for (auto &shard : mShards)
+    {
+        shard->endpoint->SetBatchSize(batchSize);
+    }
+}
+
+void Server::IntegrateInputs()
+{
+    const size_t slotsPerTask = 1024;
+    mPool->ParallelFor((mWorld.size() + slotsPerTask - 1) / slotsPerTask, [&](size_t index, size_t)
+                       { mWorld.ApplyInputRows(index * slotsPerTask, std::min(mWorld.size(), (index + 1) * slotsPerTask)); });
+    mWorld.ClearInputs();
+}
+
+void Server::PartitionRegions()
+{
+    mActiveSlots.clear();
+    mPlayerGrid.Clear();
+    for (auto &[address, client] : mClients)
+    {
+        mPlayerGrid.Insert(client.slot, mWorld.Position(client.slot));
+        mActiveSlots.push_back(client.slot);
+    }
+
+    /* A few strips per thread, so stealing has something to even out */
+    const size_t regionCount = mPool->size() * 4;
+    mRegions.resize(regionCount);
+    mRegionContacts.resize(regionCount);
+    for (auto &region : mRegions)
+    {
+        region.clear();
+    }
+
+    for (size_t dense = 0; dense < mActiveSlots.size(); dense++)
+    {
+        float x = (mWorld.x[mActiveSlots[dense]] + WORLD_WIDTH / 2) * regionCount / WORLD_WIDTH;
+        mRegions[std::clamp((size_t)std::max(x, 0.0f), (size_t)0, regionCount - 1)].push_back(dense);
+    }
+}
+
+void Server::MergeContacts()
+{
+    mContacts.clear();
+    for (const auto &contacts : mRegionContacts)
+    {
+        mContacts.insert(mContacts.end(), contacts.begin(), contacts.end());
+    }
+    std::sort(mContacts.begin(), mContacts.end());
+}
+
+void Server::CheckPlayerCollisions()
+{
+    PartitionRegions();
+
+    /* Found against the positions and radii every player had when the phase started */
+    mPool->ParallelFor(mRegions.size(), [&](size_t region, size_t worker)
+                       {
+        WorkerScratch &scratch = mScratch[worker];
+        std::vector<Contact> &contacts = mRegionContacts[region];
+        contacts.clear();
+
+        for (uint32_t eater : mRegions[region])
+        {
+            uint32_t i = mActiveSlots[eater];
+            const Vector2 position = mWorld.Position(i);
+            scratch.candidates.clear();
+            mPlayerGrid.Query(position, mWorld.radius[i], scratch.candidates, scratch.visited);
+            scratch.distances.resize(scratch.candidates.size());
+            DistanceSquared(mWorld.x.data(), mWorld.y.data(), 1, scratch.candidates.data(), scratch.candidates.size(),
+                            position.x, position.y, scratch.distances.data());
+
+            float radius = mWorld.radius[i];
+            for (size_t k = 0; k < scratch.candidates.size(); k++)
             {
-                if (player1.radius > player2.radius)
+                uint32_t j = scratch.candidates[k];
+                if (j != i && mWorld.radius[i] > mWorld.radius[j] && scratch.distances[k] < radius * radius)
                 {
-                    player1.radius += player2.radius;
-                    player2.radius = 10;
-                    player2.position = GetRandomPosition();
+                    contacts.push_back({eater, (uint32_t)mClients.DenseOf(j)});
                 }
             }
+        } });
+
+    MergeContacts();
+
+    /* A player eaten this tick neither eats nor is eaten again, and one that outgrew its eater escapes */
+    mEaten.assign(mWorld.size(), false);
+    for (const Contact &contact : mContacts)
+    {
+        uint32_t i = mActiveSlots[contact.eater];
+        uint32_t j = mActiveSlots[contact.target];
+        if (mEaten[i] || mEaten[j] || mWorld.radius[i] <= mWorld.radius[j])
+        {
+            continue;
         }
+
+        mWorld.radius[i] = std::min(mWorld.radius[i] + mWorld.radius[j], MAX_PLAYER_RADIUS);
+        mWorld.radius[j] = 10;
+        mWorld.SetPosition(j, GetRandomPosition());
+        mEaten[j] = true;
     }
 }
 
 void Server::CheckDotCollisions()
 {
-    bool broadCast = false;
-    for (auto &[id, player] : mClients)
-    {
-    next:
-        for (auto &dot : mDots)
+    mPool->ParallelFor(mRegions.size(), [&](size_t region, size_t worker)
+                       {
+        WorkerScratch &scratch = mScratch[worker];
+        std::vector<Contact> &contacts = mRegionContacts[region];
+        contacts.clear();
+
+        for (uint32_t eater : mRegions[region])
         {
+            uint32_t player = mActiveSlots[eater];
+            const Vector2 position = mWorld.Position(player);
+            scratch.candidates.clear();
+            mDotGrid.Query(position, mWorld.radius[player], scratch.candidates, scratch.visited);
+            scratch.distances.resize(scratch.candidates.size());
+            DistanceSquared(&mDots[0].x, &mDots[0].y, 2, scratch.candidates.data(), scratch.candidates.size(),
+                            position.x, position.y, scratch.distances.data());
 
-            if (Vector2Distance(player.position, dot) <= player.radius)
+            float radius = mWorld.radius[player];
+            for (size_t k = 0; k < scratch.candidates.size(); k++)
             {
-
-                player.radius += 1;
-                dot = GetRandomPosition();
-                broadCast = true;
-                goto next;
+                if (scratch.distances[k] <= radius * radius)
+                {
+                    contacts.push_back({eater, scratch.candidates[k]});
+                }
             }
+        } });
+
+    MergeContacts();
+
+    /* Each dot goes to the first player in client order that reached it, a respawn lands next tick */
+    bool eaten[DOT_COUNT] = {};
+    bool broadCast = false;
+    for (const Contact &contact : mContacts)
+    {
+        if (eaten[contact.target])
+        {
+            continue;
         }
+
+        uint32_t &radius = mWorld.radius[mActiveSlots[contact.eater]];
+        radius = std::min(radius + 1, MAX_PLAYER_RADIUS);
+        Vector2 respawn = GetRandomPosition();
+        mDotGrid.Move(contact.target, mDots[contact.target], respawn);
+        mDots[contact.target] = respawn;
+        eaten[contact.target] = true;
+        broadCast = true;
     }
 
     if (broadCast)
     {
         DotUpdatePacket packet;
         memcpy(&packet.positions, &mDots, sizeof(Vector2) * DOT_COUNT);
-        Broadcast(&packet, sizeof(DotUpdatePacket));
+        auto encoded = Encode(packet);
+        Broadcast(encoded.data, encoded.size);
+    }
+}
+
+/*
+ * Each of the tick's frames takes in whoever left or joined, then one input from every simulated
+ * client in id order, the last one again if none arrived in time. The server applies the frame to its
+ * own world for the checksum clients compare against, and keeps it encoded for sending.
+ */
+void Server::StepLockstep(size_t frames)
+{
+    LockstepFrame &frame = mLockstepFrame;
+    for (size_t f = 0; f < frames; f++)
+    {
+        /* Leaves stay queued until the world has taken the frame, past the cap they wait for the next */
+        const size_t leaves = std::min<size_t>(mLockstepLeaves.size(), LOCKSTEP_MAX_CHANGES);
+        frame.leaves.clear();
+        size_t staying = mLockstepWorld.Players().size();
+        for (size_t i = 0; i < leaves; i++)
+        {
+            frame.leaves.push_back(mLockstepLeaves[i].id);
+            staying -= mLockstepWorld.Find(mLockstepLeaves[i].id) != nullptr;
+        }
+
+        /* An id still in the world, or still waiting to leave it, has to wait for a later frame */
+        auto contains = [](const std::vector<int> &ids, int id)
+        {
+            return std::find(ids.begin(), ids.end(), id) != ids.end();
+        };
+        auto leaving = [&](int id)
+        {
+            return std::any_of(mLockstepLeaves.begin() + leaves, mLockstepLeaves.end(), [id](const LockstepLeave &leave)
+                               { return leave.id == id; });
+        };
+        frame.joins.clear();
+        mJoining.clear();
+        for (auto &[address, client] : mClients)
+        {
+            if (frame.joins.size() == LOCKSTEP_MAX_CHANGES || staying + frame.joins.size() >= LOCKSTEP_MAX_PLAYERS)
+            {
+                break;
+            }
+            if (client.simulated || contains(frame.joins, client.id) || leaving(client.id) ||
+                (mLockstepWorld.Find(client.id) && !contains(frame.leaves, client.id)))
+            {
+                continue;
+            }
+            frame.joins.push_back(client.id);
+            mJoining.push_back(&client);
+        }
+
+        /*
+         * Rebuilt after any change, the table may have moved clients since the last tick. Leavers past
+         * the cap are still in the world, they keep their seat with the last input they sent
+         */
+        if (f == 0 || !frame.leaves.empty() || !frame.joins.empty())
+        {
+            mRoster.clear();
+            for (auto &[address, client] : mClients)
+            {
+                if (client.simulated)
+                {
+                    mRoster.push_back({.id = client.id, .client = &client, .input = client.lastInput});
+                }
+            }
+            for (ClientInfo *client : mJoining)
+            {
+                mRoster.push_back({.id = client->id, .client = client, .input = client->lastInput});
+            }
+            for (size_t i = leaves; i < mLockstepLeaves.size(); i++)
+            {
+                if (mLockstepWorld.Find(mLockstepLeaves[i].id))
+                {
+                    mRoster.push_back({.id = mLockstepLeaves[i].id, .client = nullptr, .input = mLockstepLeaves[i].lastInput});
+                }
+            }
+            std::sort(mRoster.begin(), mRoster.end(), [](const LockstepSeat &a, const LockstepSeat &b)
+                      { return a.id < b.id; });
+        }
+
+        frame.inputs.resize(mRoster.size());
+        for (size_t i = 0; i < mRoster.size(); i++)
+        {
+            LockstepSeat &seat = mRoster[i];
+            if (seat.client)
+            {
+                ClientInfo &client = *seat.client;
+                uint8_t input;
+                uint64_t sequence;
+
+                /* A frame plays one input, so a backlog well past its target catches up by dropping the oldest */
+                if (client.inputs.Depth() > client.inputs.TargetDepth() + INPUT_BUFFER_SIZE)
+                {
+                    client.inputs.Pop(input, sequence);
+                }
+                if (client.inputs.Pop(input, sequence))
+                {
+                    client.lastInput = input;
+                    client.processedInputs = sequence + 1;
+                }
+                seat.input = client.lastInput;
+            }
+            frame.inputs[i] = seat.input;
+        }
+
+        /* A frame the world won't take would desync every client, nothing of it is kept or sent */
+        const uint32_t number = mLockstepWorld.Frame();
+        if (!mLockstepWorld.Apply(frame))
+        {
+            std::cerr << "Lockstep frame " << number << " has " << frame.inputs.size() << " inputs for "
+                      << mLockstepWorld.Players().size() << " players, dropped\n";
+            break;
+        }
+        frame.checksum = mLockstepWorld.Checksum();
+
+        mLockstepLeaves.erase(mLockstepLeaves.begin(), mLockstepLeaves.begin() + leaves);
+        for (ClientInfo *client : mJoining)
+        {
+            client->simulated = true;
+        }
+
+        const size_t slot = number % LOCKSTEP_HISTORY;
+        BitWriter writer(&mFrameData[slot * MAX_LOCKSTEP_FRAME_BYTES], MAX_LOCKSTEP_FRAME_BYTES);
+        WriteLockstepFrame(writer, frame);
+        mFrameSizes[slot] = writer.BytesWritten();
+        mFramesKept = std::min<uint32_t>(mFramesKept + 1, LOCKSTEP_HISTORY);
+    }
+}
+
+/*
+ * Every client is sent the frames from the one it asked for up to the newest, so frames lost on the
+ * way go again until acknowledged. One too far behind for the history, or without a world yet, is
+ * sent the whole world instead.
+ */
+void Server::SendLockstep()
+{
+    const uint32_t newest = mLockstepWorld.Frame();
+    const uint32_t oldest = newest - mFramesKept;
+    const size_t headerBytes = SchemaOf<LockstepFramesPacket>::Type::bytes;
+    mStateData.clear();
+    mStateSizes.clear();
+
+    for (auto &[address, client] : mClients)
+    {
+        SendQueue &outbox = mShards[client.shard]->outbox;
+
+        if (client.nextFrame == NO_FRAME || client.nextFrame < oldest || client.nextFrame > newest)
+        {
+            if (mStateSizes.empty())
+            {
+                EncodeLockstepState(mLockstepWorld, mStateData, mStateSizes);
+            }
+
+            size_t offset = 0;
+            for (uint16_t size : mStateSizes)
+            {
+                outbox.Push(&mStateData[offset], size, address);
+                offset += size;
+            }
+            continue;
+        }
+
+        LockstepFramesPacket header;
+        header.processedInputs = client.processedInputs;
+        header.newestFrame = newest;
+
+        uint32_t first = client.nextFrame;
+        const uint32_t last = std::min<uint32_t>(newest, first + LOCKSTEP_RESEND_FRAMES);
+        while (first < last)
+        {
+            char buffer[MAX_DATAGRAM_SIZE];
+            size_t size = headerBytes;
+            uint32_t frame = first;
+            while (frame < last && size + mFrameSizes[frame % LOCKSTEP_HISTORY] <= MAX_DATAGRAM_SIZE)
+            {
+                const size_t slot = frame % LOCKSTEP_HISTORY;
+                memcpy(buffer + size, &mFrameData[slot * MAX_LOCKSTEP_FRAME_BYTES], mFrameSizes[slot]);
+                size += mFrameSizes[slot];
+                frame++;
+            }
+
+            header.firstFrame = first;
+            header.frameCount = frame - first;
+            BitWriter writer(buffer, headerBytes);
+            SchemaOf<LockstepFramesPacket>::Type::Write(writer, header);
+            outbox.Push(buffer, size, address);
+            first = frame;
+        }
     }
 }
 
 void Server::CreateDots()
 {
+    mDotGrid.Clear();
     for (int i = 0; i < DOT_COUNT; i++)
     {
         mDots[i] = GetRandomPosition();
+        mDotGrid.Insert(i, mDots[i]);
     }
 }
 
+uint64_t Server::ServerMicros() const
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(TickScheduler::Clock::now() - mSteadyStart).count();
+}
+
 Vector2 Server::GetRandomPosition()
 {
-    return {(float)GetRandomValue(-(WORLD_WIDTH / 2), (WORLD_HEIGHT / 2)),
-            (float)GetRandomValue(-(WORLD_WIDTH / 2), (WORLD_HEIGHT / 2))};
+    int x = mRandom.Range(-(WORLD_WIDTH / 2), WORLD_WIDTH / 2);
+    int y = mRandom.Range(-(WORLD_HEIGHT / 2), WORLD_HEIGHT / 2);
+    return {(float)x, (float)y};
 }
@@ -2,48 +2,380 @@
 #include "UdpSocket.hpp"
 #include "Shared.hpp"
 #include "Shutdown.hpp"
-#include <mutex>
-#include <map>
+#include "EventLoop.hpp"
+#include "MpscQueue.hpp"
+#include "SpatialGrid.hpp"
+#include "ClientTable.hpp"
+#include "PlayerStore.hpp"
+#include "WorkerPool.hpp"
+#include "Metrics.hpp"
+#include "TickScheduler.hpp"
+#include "Capture.hpp"
+#include "Lockstep.hpp"
+#include <array>
+#include <random>
+#include <shared_mutex>
+#include <unordered_set>
 
 class Server
 {
-    struct SockAddrCompare
+    /* bin bench times the private step phases */
+    friend struct BenchAccess;
+    /* bin replay feeds captured datagrams and ticks straight in */
+    friend struct ReplayAccess;
+
+    /* Decoded datagram handed from the receive thread to Step() */
+    struct IngressEvent
     {
-        bool operator()(const sockaddr_in &a, const sockaddr_in &b) const
-        {
+        MSG type;
+        sockaddr_in sender;
+        /* Input entries and windows both arrive as inputs[0, inputCount) for sequences firstSequence onward */
+        uint64_t firstSequence;
+        uint16_t inputCount;
+        uint8_t inputs[INPUT_WINDOW_SIZE];
+        /* The snapshot acked, or for a FRAME_ACK the next lockstep frame wanted */
+        uint32_t snapshotId;
+        /* Milliseconds since mStartTime, stamped on receipt for jitter measurement */
+        float arrival;
+    };
+
+    /*
+     * One socket, receive thread, ingress queue and outbox per shard. A standalone server opens its
+     * shards on the same port with SO_REUSEPORT, so parsing spreads over cores and only Step() touches
+     * more than one shard. A client belongs to the shard that received its CONNECT and is answered
+     * from it. A hosted server has a single shard on its owner's socket.
+     */
+    struct Shard
+    {
+        UdpSocket socket;
+        UdpSocket *endpoint{&socket};
+        /* Fed by this shard's receive thread alone, drained by Step() */
+        MpscQueue<IngressEvent> ingress{4096};
+        SendQueue outbox;
+        /* Written by the receive thread */
+        Counter packetsIn;
+        Counter bytesIn;
+    };
+
+    enum Phase
+    {
+        PHASE_INPUT_DRAIN,
+        PHASE_HEARTBEAT,
+        PHASE_COLLISIONS,
+        PHASE_SNAPSHOT_BUILD,
+        PHASE_BROADCAST,
+        PHASE_COUNT
+    };
+
+    /* Written by whichever thread runs Tick(), read by FormatMetrics() from any */
+    struct TickMetrics
+    {
+        Histogram tick;
+        Histogram phases[PHASE_COUNT];
+        Counter ticks;
+        /* Ticks that took longer than the step, and ticks the overrun policy dropped */
+        Counter overruns;
+        Counter skipped;
+        Counter packetsOut;
+        Counter bytesOut;
+        /* Datagrams a full send buffer turned away */
+        Counter sendDrops;
+        /* Input entries buffered across clients after the tick played its share */
+        Counter inputDepthTotal;
+        Counter inputDepthMax;
+    };
 
-            if (a.sin_addr.s_addr != b.sin_addr.s_addr)
-            {
-                return a.sin_addr.s_addr < b.sin_addr.s_addr;
-            }
+    struct DeltaEntry
+    {
+        uint8_t flags;
+        PlayerState state;
+    };
 
-            return a.sin_port < b.sin_port;
+    /* Scratch for one thread of the parallel phases in Step() */
+    struct WorkerScratch
+    {
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> visited;
+        std::vector<float> distances;
+        std::vector<int> view;
+        std::vector<DeltaEntry> deltas;
+        std::vector<size_t> fragmentStarts;
+    };
+
+    /* Snapshots encoded for a run of clients, queued for sending once every worker is done */
+    struct EncodedBatch
+    {
+        std::vector<char> data;
+        std::vector<uint16_t> sizes;
+        /* Fragments per client, in dense order */
+        std::vector<uint16_t> fragmentCounts;
+    };
+
+    /* A collision found by a region: a dense client index and what it touched, another client or a dot */
+    struct Contact
+    {
+        uint32_t eater;
+        uint32_t target;
+
+        bool operator<(const Contact &other) const
+        {
+            return eater != other.eater ? eater < other.eater : target < other.target;
         }
     };
 
+    /* A sent snapshot, kept so later ones can be encoded as deltas against it. Sorted by id */
+    struct Snapshot
+    {
+        uint32_t id{NO_BASELINE};
+        std::vector<PlayerState> players;
+    };
+
+    /* A lockstep player gone from the table, playing its last input until a frame takes it out */
+    struct LockstepLeave
+    {
+        int id;
+        uint8_t lastInput;
+    };
+
+    /* A lockstep player a frame holds an input for, a client or a leaver whose frame hasn't come yet */
+    struct LockstepSeat
+    {
+        int id;
+        ClientInfo *client;
+        uint8_t input;
+    };
+
+public:
+    struct IngressStats
+    {
+        size_t depth;
+        size_t capacity;
+        uint64_t overflows;
+    };
+
+    struct TickStats
+    {
+        uint64_t ticks;
+        double meanTickMs;
+        double maxTickMs;
+    };
+
+    struct ClientInputStats
+    {
+        int id;
+        JitterBuffer<uint8_t>::Stats inputs;
+    };
+
 private:
-    UdpSocket mSock;
+    std::vector<std::unique_ptr<Shard>> mShards;
+    int mShardCount{1};
+    bool mSteerShards{false};
+    std::string mBindAddress{"127.0.0.1"};
+    EventLoop mLoop;
+    NetBackend mBackend{NetBackend::Thread};
     int mPort;
     bool mRunning{false};
-    static const int mServerStepMs = 100;
-    std::map<sockaddr_in, ClientInfo, SockAddrCompare> mClients;
-    std::mutex mMutex;
+    std::atomic<size_t> mPlayerCount{0};
+    /* Tick() timings since the last TakeTickStats() */
+    std::atomic<uint64_t> mTicks{0};
+    std::atomic<uint64_t> mTickNanos{0};
+    std::atomic<uint64_t> mMaxTickNanos{0};
+    TickMetrics mMetrics;
+    /* Answers any datagram with FormatMetrics(), 0 for none */
+    int mStatsPort{0};
+    UdpSocket mStatsSocket;
+    std::chrono::seconds mStatsInterval{0};
+    std::chrono::steady_clock::time_point mNextStatsDump;
+    TickScheduler mScheduler;
+    /* A client that sends nothing for this long is dropped */
+    static constexpr std::chrono::milliseconds mHeartbeatTimeout{1000};
+    int mBatchSize{64};
+    int mMaxPlayers{DEFAULT_MAX_PLAYERS};
+    uint32_t mSnapshotId{0};
+    std::vector<PlayerState> mSnapshot;
+    /* A client whose ack is older than this history gets a full snapshot */
+    CircularBuffer<Snapshot> mHistory{32};
+    ClientTable mClients;
+    std::vector<sockaddr_in> mBroadcastAddresses;
     std::chrono::high_resolution_clock::time_point mStartTime;
-    float mTime{0.0f};
+    TickScheduler::Clock::time_point mSteadyStart;
+    /* The tick being stepped, and milliseconds from the start to when it was due */
+    uint64_t mTick{0};
+    double mTime{0.0};
+    /* Client frames' worth of input per tick not yet played, the fraction carries to the next tick */
+    double mInputBudget{0.0};
     Vector2 mDots[DOT_COUNT];
+    /* Per server rather than raylib's global one, so rooms on different threads don't share it */
+    uint32_t mSeed{std::random_device{}()};
+    DeterministicRandom mRandom{mSeed};
+    /* Inbound traffic from Start() on, when a path is set. Receive threads and the tick share the file */
+    std::string mCapturePath;
+    CaptureWriter mCapture;
+    std::atomic<bool> mCapturing{false};
+    std::mutex mCaptureMutex;
+    /* Replaying a capture: everything is encoded and counted, nothing is sent */
+    bool mOffline{false};
+    /* ClientTable keys of connected clients, so receive threads can vet pings without touching mClients */
+    std::unordered_set<uint64_t> mKnownEndpoints;
+    std::shared_mutex mKnownMutex;
+    /* Collision broadphase: players are rebuilt every tick, dots are moved as they get eaten */
+    static constexpr float mGridCellSize = 32.0f;
+    SpatialGrid mPlayerGrid{mGridCellSize};
+    SpatialGrid mDotGrid{mGridCellSize};
+    PlayerStore mWorld;
+    std::vector<uint32_t> mActiveSlots;
+    std::vector<bool> mEaten;
+    /*
+     * Parallel step: collisions are found per region, vertical strips of the world holding dense
+     * client indices, then applied serially in (eater, target) order, so the outcome doesn't depend
+     * on how many threads found them.
+     */
+    std::unique_ptr<WorkerPool> mPool{std::make_unique<WorkerPool>(1)};
+    std::vector<WorkerScratch> mScratch{1};
+    std::vector<std::vector<uint32_t>> mRegions;
+    std::vector<std::vector<Contact>> mRegionContacts;
+    std::vector<Contact> mContacts;
+    std::vector<EncodedBatch> mBatches;
+    /* Interest management: clients only see players within this radius of themselves */
+    float mInterestRadius{DEFAULT_INTEREST_RADIUS};
+    float mInterestExitRadius{DEFAULT_INTEREST_EXIT_RADIUS};
+    SpatialGrid mInterestGrid{mGridCellSize * 4};
+    /*
+     * Lockstep: clients are sent every player's inputs instead of snapshots and run the simulation
+     * themselves. The server runs it too, for the checksums and for the world a joining client starts from
+     */
+    bool mLockstep{false};
+    LockstepWorld mLockstepWorld;
+    LockstepFrame mLockstepFrame;
+    /*
+     * The last LOCKSTEP_HISTORY frames encoded, frame n in slot n % LOCKSTEP_HISTORY, so recording one
+     * copies into place instead of allocating. mFramesKept of them end at mLockstepWorld.Frame()
+     */
+    static constexpr size_t MAX_LOCKSTEP_FRAME_BYTES = (MAX_LOCKSTEP_FRAME_BITS + 7) / 8;
+    std::vector<char> mFrameData = std::vector<char>(LOCKSTEP_HISTORY * MAX_LOCKSTEP_FRAME_BYTES);
+    std::array<uint16_t, LOCKSTEP_HISTORY> mFrameSizes{};
+    uint32_t mFramesKept{0};
+    /* Players gone from the table, leaving the simulation as fast as frames take them */
+    std::vector<LockstepLeave> mLockstepLeaves;
+    /* Everyone in the world after this frame's changes, in id order, the order of a frame's inputs */
+    std::vector<LockstepSeat> mRoster;
+    /* Clients joining in the frame being built, simulated once the world has taken it */
+    std::vector<ClientInfo *> mJoining;
+    /* The world encoded at most once a tick, for whichever clients need it */
+    std::vector<char> mStateData;
+    std::vector<uint16_t> mStateSizes;
 
-    void ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender);
+    void ReceiveMessage(char *buffer, int bytesRead, sockaddr_in sender, uint32_t shard);
+    void Ingest(const char *buffer, int bytesRead, sockaddr_in sender, uint32_t shard, float arrival);
+    /* Kept in step with mClients by the tick */
+    void SetKnown(const sockaddr_in &address, bool known);
+    void DrainIngress();
+    void DrainShard(uint32_t shard);
     void Step();
+    void TickAt(uint64_t tick, double time);
+    void RunDue(TickScheduler::Due due);
     void Broadcast(void *data, int size);
+    void FlushShards();
+    void BroadcastSnapshot();
+    const Snapshot *FindSnapshot(uint32_t id) const;
+    void UpdateInterest(const ClientInfo &client, const InterestSet *previous, WorkerScratch &scratch);
+    void EncodeSnapshot(WorkerScratch &scratch, EncodedBatch &batch, uint32_t snapshotId, uint32_t baselineId,
+                        const std::vector<PlayerState> *baseline, const std::vector<int> *baselineView,
+                        uint64_t processedInputs);
+    void IntegrateInputs();
     void CreateDots();
     Vector2 GetRandomPosition();
+    /* Time on the clock snapshots are stamped with, for answering pings from any thread */
+    uint64_t ServerMicros() const;
+    void PartitionRegions();
+    void MergeContacts();
     void CheckPlayerCollisions();
     void CheckDotCollisions();
+    void StepLockstep(size_t frames);
+    void SendLockstep();
 
 public:
     Server(int port);
 
-    void Attach();
+    /*
+     * A room behind someone else's socket: no Attach() or Run(), the owner feeds it datagrams with
+     * Deliver() and calls Start(), then Tick() every step from any one thread at a time.
+     */
+    explicit Server(UdpSocket &endpoint);
+
+    void Attach(NetBackend backend = NetBackend::Thread);
+
+    /* Connects beyond this many clients are turned away with a DISCONNECT */
+    void SetMaxPlayers(int maxPlayers);
+
+    /* Players enter a client's view within radius and leave it beyond exitRadius */
+    void SetInterestRadius(float radius, float exitRadius);
+
+    /*
+     * Threads running the simulation step, including the one calling Run(). Results are the same
+     * for any count. Call before Run()
+     */
+    void SetWorkerThreads(int threads);
+
+    /* Respawn positions are drawn from this seed from now on */
+    void SetSeed(uint32_t seed);
+
+    /*
+     * Exchange inputs instead of positions: every tick's frames go to all clients, which simulate the
+     * world deterministically and check it against the server's checksums. Before Start()
+     */
+    void SetLockstep(bool lockstep);
+
+    /* Records every inbound datagram and tick to path from Start() on, for bin replay. Before Start() */
+    void SetCapture(const std::string &path);
+
+    /* Address Attach() binds to, 0.0.0.0 for every interface */
+    void SetBindAddress(const std::string &address);
+
+    /*
+     * Sockets Attach() opens on the port, each with its own receive thread. With steer, a cBPF
+     * program picks the shard from the client's address and port instead of the kernel's hash
+     */
+    void SetShards(int shards, bool steer);
+
+    /* Ticks per second for Run(), may be changed while running from the thread calling Run() */
+    void SetTickRate(double hz);
+
+    /* What Run() does about ticks whose deadline passed while an earlier one overran */
+    void SetOverrunPolicy(TickScheduler::OverrunPolicy policy, int maxCatchUp = 4);
+
+    /* Run() busy waits this long before each deadline instead of sleeping, for sub-millisecond accuracy */
+    void SetTickSpin(std::chrono::microseconds spin);
+
+    /* Datagrams per recvmmsg/sendmmsg call */
+    void SetBatchSize(int batchSize);
+
+    /* Summed over shards */
+    IngressStats GetIngressStats() const;
+
+    /* Attach() answers any datagram to 127.0.0.1:port with FormatMetrics(), 0 to disable */
+    void SetStatsPort(int port);
+
+    /* Run() prints FormatMetrics() this often, 0 for never */
+    void SetStatsInterval(int seconds);
+
+    /* Phase timings, traffic, clients and queue depths as "name value" lines. Thread safe */
+    std::string FormatMetrics() const;
+
+    /* Ticks run and how long they took since the previous call, thread safe */
+    TickStats TakeTickStats();
+
+    /* Per client input buffering. Reads client state, so only call it from the thread running Step() */
+    void GetInputStats(std::vector<ClientInputStats> &out);
 
     void Run();
+
+    void Start();
+    void Tick();
+    /* Tells every client the server is going away */
+    void Stop();
+    /* Thread safe, the datagram is queued for the next Tick() */
+    void Deliver(char *buffer, int bytesRead, sockaddr_in sender);
+    /* Clients as of the last Tick(), thread safe */
+    size_t PlayerCount() const;
 };
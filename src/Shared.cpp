@@ -12,4 +12,112 @@ void ApplyInput(Vector2 *position, uint8_t input, uint32_t radius)
         position->x += MOVE_SPEED;
     if (input & (1 << 3))
         position->x -= MOVE_SPEED;
-}
\ No newline at end of file
+
+    position->x = std::clamp(position->x, (float)-(WORLD_WIDTH / 2), (float)(WORLD_WIDTH / 2));
+    position->y = std::clamp(position->y, (float)-(WORLD_HEIGHT / 2), (float)(WORLD_HEIGHT / 2));
+}
+
+void WriteDeltaEntry(BitWriter &writer, uint8_t flags, const PlayerState &state)
+{
+    PlayerIdCodec::Write(writer, state.id);
+    DeltaFlagsCodec::Write(writer, flags);
+
+    if (flags & DELTA_POSITION)
+    {
+        WorldPositionCodec::Write(writer, state.position);
+    }
+    if (flags & DELTA_RADIUS)
+    {
+        RadiusCodec::Write(writer, state.radius);
+    }
+}
+
+void ReadDeltaEntry(BitReader &reader, uint8_t &flags, PlayerState &state)
+{
+    PlayerIdCodec::Read(reader, state.id);
+    DeltaFlagsCodec::Read(reader, flags);
+
+    if (flags & DELTA_POSITION)
+    {
+        WorldPositionCodec::Read(reader, state.position);
+    }
+    if (flags & DELTA_RADIUS)
+    {
+        RadiusCodec::Read(reader, state.radius);
+    }
+}
+
+void WriteInputRun(BitWriter &writer, const InputRun &run)
+{
+    InputCodec::Write(writer, run.input);
+    RunLengthCodec::Write(writer, run.length);
+}
+
+void ReadInputRun(BitReader &reader, InputRun &run)
+{
+    InputCodec::Read(reader, run.input);
+    RunLengthCodec::Read(reader, run.length);
+}
+
+size_t EncodeInputWindow(char *buffer, size_t capacity, uint64_t firstSequence, const uint8_t *inputs, size_t count)
+{
+    InputWindowPacket header;
+    header.firstSequence = firstSequence;
+    header.runCount = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        header.runCount += i == 0 || inputs[i] != inputs[i - 1];
+    }
+
+    BitWriter writer(buffer, capacity);
+    SchemaOf<InputWindowPacket>::Type::Write(writer, header);
+
+    for (size_t i = 0; i < count;)
+    {
+        InputRun run{.input = inputs[i], .length = 0};
+        while (i < count && inputs[i] == run.input)
+        {
+            run.length++;
+            i++;
+        }
+        WriteInputRun(writer, run);
+    }
+
+    return writer.Ok() ? writer.BytesWritten() : 0;
+}
+
+bool DecodeInputWindow(const char *buffer, int size, uint64_t &firstSequence, uint8_t *inputs, size_t &count)
+{
+    InputWindowPacket header;
+    BitReader reader(buffer, size);
+    SchemaOf<InputWindowPacket>::Type::Read(reader, header);
+
+    count = 0;
+    for (int i = 0; i < header.runCount && reader.Ok(); i++)
+    {
+        InputRun run;
+        ReadInputRun(reader, run);
+        if (!reader.Ok() || run.length == 0 || count + run.length > INPUT_WINDOW_SIZE)
+        {
+            return false;
+        }
+
+        memset(&inputs[count], run.input, run.length);
+        count += run.length;
+    }
+
+    firstSequence = header.firstSequence;
+    return reader.Ok();
+}
+
+bool PeekType(const char *buffer, int size, MSG &type)
+{
+    PacketHeader header;
+    if (!Decode(buffer, size, header))
+    {
+        return false;
+    }
+
+    type = header.type;
+    return true;
+}
@@ -4,15 +4,28 @@
 #include <mutex>
 #include "raylib.h"
 #include "raymath.h"
-#include <queue>
 #include "CircularBuffer.hpp"
+#include "JitterBuffer.hpp"
+#include "Schema.hpp"
 
 #define INPUT_BUFFER_SIZE 10
-#define MAX_PLAYER_COUNT 10
+#define MAX_DATAGRAM_SIZE 1200
+#define DEFAULT_MAX_PLAYERS 1024
+/* Clients sample one input per frame at 100 FPS, the server buffers them per input */
+#define INPUT_FRAME_INTERVAL_MS 10.0f
+#define INPUT_JITTER_CAPACITY 256
+/* Most unacknowledged inputs an input window carries, older ones are given up on */
+#define INPUT_WINDOW_SIZE 128
+/* Half the client's view across, so a crowded world doesn't send everyone to everyone */
+#define DEFAULT_INTEREST_RADIUS 200.0f
+/* Past the enter radius so players near the edge don't flicker in and out */
+#define DEFAULT_INTEREST_EXIT_RADIUS 250.0f
 #define WORLD_WIDTH 400
 #define WORLD_HEIGHT 300
 #define DOT_COUNT 10
 #define DOT_RADIUS 3
+/* Past the world's diagonal a player already covers all of it, growth stops there so radii fit 9 bits */
+#define MAX_PLAYER_RADIUS 511u
 
 enum class MSG
 {
@@ -21,41 +34,82 @@ enum class MSG
     PLAYER_UPDATE,
     WORLD_UPDATE,
     TIME_SYNC,
-    DOT_UPDATE
+    DOT_UPDATE,
+    SNAPSHOT_ACK,
+    INPUT_WINDOW,
+    TIME_PING,
+    TIME_PONG,
+    LOCKSTEP_FRAMES,
+    LOCKSTEP_STATE,
+    FRAME_ACK,
+    COUNT
 };
 
 struct Position
 {
     Vector2 position;
-    float time;
+    /* Server time in ms, kept in double so hours-long sessions still resolve a tick */
+    double time;
 };
 
 struct Player
 {
     int id;
     uint32_t radius{10};
-    CircularBuffer<Position> positions{10};
+    /* Inline so recording a snapshot's position never allocates. A new player still costs its map node */
+    CircularBuffer<Position, 16> positions{};
+    /* Positions ever pushed, so indices stay put while the oldest fall off the history */
+    uint64_t pushed{0};
+    /* Index of the newest position no later than the last render time, counted like pushed */
+    uint64_t cursor{0};
+
+    void Push(const Position &position)
+    {
+        positions.push(position);
+        pushed++;
+    }
 };
 
 struct InputEntry
 {
     uint64_t sequenceNum;
     uint8_t input[INPUT_BUFFER_SIZE];
+};
 
-    bool operator>(const InputEntry &other) const
-    {
-        return sequenceNum > other.sequenceNum;
-    }
+/* Snapshot ids are sequential and never reach this, it marks a snapshot sent without a baseline */
+constexpr uint32_t NO_BASELINE = UINT32_MAX;
+
+/* Lockstep frames are counted from 0, this marks a client that has no world and wants the whole of it */
+constexpr uint32_t NO_FRAME = UINT32_MAX;
+
+/* The players a client was sent in one snapshot, sorted */
+struct InterestSet
+{
+    uint32_t snapshotId{NO_BASELINE};
+    std::vector<int> ids;
 };
 
 struct ClientInfo
 {
     uint64_t lastCheckIn{0};
     int id;
-    std::priority_queue<InputEntry, std::vector<InputEntry>, std::greater<InputEntry>> inputQueue;
-    uint64_t lastProcessedSequence{0};
-    Vector2 position;
-    uint32_t radius{10};
+    /* Keyed by input sequence, one per client frame */
+    JitterBuffer<uint8_t> inputs{INPUT_JITTER_CAPACITY, INPUT_FRAME_INTERVAL_MS};
+    /* One past the newest input sequence played, 0 before the first */
+    uint64_t processedInputs{0};
+    /* Index of this client's position and radius in the server's PlayerStore */
+    uint32_t slot{0};
+    /* The server shard whose socket this client talks to */
+    uint32_t shard{0};
+    uint32_t ackedSnapshot{NO_BASELINE};
+    /* What each recent snapshot showed this client, a delta's baseline is the view it acked */
+    CircularBuffer<InterestSet> sentInterest{32};
+    /* Lockstep: the next frame this client wants, NO_FRAME until it has the world */
+    uint32_t nextFrame{NO_FRAME};
+    /* In the lockstep world, which only takes in a few joins a frame */
+    bool simulated{false};
+    /* Played again for a frame its input didn't arrive in time for */
+    uint8_t lastInput{0};
 };
 
 struct PacketHeader
@@ -66,8 +120,26 @@ struct PacketHeader
 struct TimeSyncPacket
 {
     PacketHeader header{.type = MSG::TIME_SYNC};
-    float serverTime;
-    uint64_t startTimeNanos;
+    /* Microseconds since the server started */
+    uint64_t serverTime;
+};
+
+/* Client clock in microseconds, echoed back so the client keeps no state per ping */
+struct TimePingPacket
+{
+    PacketHeader header{.type = MSG::TIME_PING};
+    uint64_t clientSend;
+    /* Zeros, so a ping is never smaller than the pong it gets back */
+    uint64_t padding[2]{};
+};
+
+/* Server times are microseconds on the clock snapshots are stamped with */
+struct TimePongPacket
+{
+    PacketHeader header{.type = MSG::TIME_PONG};
+    uint64_t clientSend;
+    uint64_t serverReceive;
+    uint64_t serverSend;
 };
 
 struct PlayerUpdatePacket
@@ -75,20 +147,214 @@ struct PlayerUpdatePacket
     PacketHeader header{.type = MSG::PLAYER_UPDATE};
     InputEntry entry;
 };
+/*
+ * Every input the server hasn't acknowledged yet, oldest first, followed by runCount runs of equal
+ * inputs (see WriteInputRun). Sent every few frames, so a lost datagram is covered by the next one.
+ */
+struct InputWindowPacket
+{
+    PacketHeader header{.type = MSG::INPUT_WINDOW};
+    uint64_t firstSequence;
+    uint16_t runCount;
+};
+
+struct InputRun
+{
+    uint8_t input;
+    uint8_t length;
+};
+
 struct DotUpdatePacket
 {
     PacketHeader header{.type = MSG::DOT_UPDATE};
     Vector2 positions[DOT_COUNT];
 };
 
+struct PlayerState
+{
+    int id;
+    Vector2 position;
+    uint32_t radius;
+};
+
+/*
+ * One fragment of a world snapshot, followed by entryCount delta entries (see WriteDeltaEntry).
+ * The snapshot is encoded against baselineId, a snapshot the client acknowledged: players that
+ * didn't change are left out, players that left are sent as removals. With NO_BASELINE every player
+ * is sent in full. Entries are split over fragmentCount datagrams of at most MAX_DATAGRAM_SIZE bytes.
+ */
 struct WorldUpdatePacket
 {
     PacketHeader header{.type = MSG::WORLD_UPDATE};
-    float time;
-    int playerCount;
-    int playerIds[MAX_PLAYER_COUNT];
-    Vector2 playerPositions[MAX_PLAYER_COUNT];
-    uint32_t playerRadius[MAX_PLAYER_COUNT];
+    uint32_t snapshotId;
+    uint32_t baselineId;
+    /* Microseconds since the server started, a float would lose whole ticks within hours */
+    uint64_t time;
+    /* One past the newest of this client's inputs the server has played, acknowledges input windows */
+    uint64_t processedInputs;
+    uint16_t fragmentIndex;
+    uint16_t fragmentCount;
+    uint16_t entryCount;
+};
+
+/* Sent by the client once every fragment of a snapshot arrived, the server deltas against it from then on */
+struct SnapshotAckPacket
+{
+    PacketHeader header{.type = MSG::SNAPSHOT_ACK};
+    uint32_t snapshotId;
+};
+
+enum DeltaFlags : uint8_t
+{
+    DELTA_POSITION = 1 << 0,
+    DELTA_RADIUS = 1 << 1,
+    DELTA_REMOVED = 1 << 2
+};
+
+/* Positions are clamped to the world and sent in 1/256 unit steps */
+using WorldX = QuantizedFloatCodec<-(WORLD_WIDTH / 2), WORLD_WIDTH / 2, 256>;
+using WorldY = QuantizedFloatCodec<-(WORLD_HEIGHT / 2), WORLD_HEIGHT / 2, 256>;
+using WorldPositionCodec = Vector2Codec<WorldX, WorldY>;
+/* Ids are the client's UDP port, so every one fits */
+using PlayerIdCodec = UIntCodec<int, UINT16_MAX>;
+/* Both simulations stop growth at MAX_PLAYER_RADIUS, so clamping here never changes a value */
+using RadiusCodec = UIntCodec<uint32_t, MAX_PLAYER_RADIUS>;
+using DeltaFlagsCodec = UIntCodec<uint8_t, DELTA_POSITION | DELTA_RADIUS | DELTA_REMOVED>;
+using InputCodec = UIntCodec<uint8_t, 0x1f>;
+using RunLengthCodec = UIntCodec<uint8_t, INPUT_WINDOW_SIZE>;
+
+template <>
+struct SchemaOf<PacketHeader>
+{
+    using Type = Schema<PacketHeader, Field<&PacketHeader::type, EnumCodec<MSG, (int)MSG::COUNT>>>;
 };
 
-void ApplyInput(Vector2 *position, uint8_t input, uint32_t radius);
+template <>
+struct SchemaOf<InputEntry>
+{
+    /* Only the low five bits of an input are used */
+    using Type = Schema<InputEntry,
+                        Field<&InputEntry::sequenceNum, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&InputEntry::input, ArrayCodec<InputCodec, INPUT_BUFFER_SIZE>>>;
+};
+
+template <>
+struct SchemaOf<TimeSyncPacket>
+{
+    using Type = Schema<TimeSyncPacket,
+                        Field<&TimeSyncPacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&TimeSyncPacket::serverTime, UIntCodec<uint64_t, UINT64_MAX>>>;
+};
+
+template <>
+struct SchemaOf<TimePingPacket>
+{
+    using Type = Schema<TimePingPacket,
+                        Field<&TimePingPacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&TimePingPacket::clientSend, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&TimePingPacket::padding, ArrayCodec<UIntCodec<uint64_t, UINT64_MAX>, 2>>>;
+};
+
+template <>
+struct SchemaOf<TimePongPacket>
+{
+    using Type = Schema<TimePongPacket,
+                        Field<&TimePongPacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&TimePongPacket::clientSend, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&TimePongPacket::serverReceive, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&TimePongPacket::serverSend, UIntCodec<uint64_t, UINT64_MAX>>>;
+};
+
+/* The server answers pings from the receive thread, the answer must not amplify */
+static_assert(SchemaOf<TimePingPacket>::Type::bytes >= SchemaOf<TimePongPacket>::Type::bytes);
+
+template <>
+struct SchemaOf<PlayerUpdatePacket>
+{
+    using Type = Schema<PlayerUpdatePacket,
+                        Field<&PlayerUpdatePacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&PlayerUpdatePacket::entry, SchemaOf<InputEntry>::Type>>;
+};
+
+template <>
+struct SchemaOf<InputWindowPacket>
+{
+    using Type = Schema<InputWindowPacket,
+                        Field<&InputWindowPacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&InputWindowPacket::firstSequence, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&InputWindowPacket::runCount, UIntCodec<uint16_t, INPUT_WINDOW_SIZE>>>;
+};
+
+template <>
+struct SchemaOf<DotUpdatePacket>
+{
+    using Type = Schema<DotUpdatePacket,
+                        Field<&DotUpdatePacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&DotUpdatePacket::positions, ArrayCodec<WorldPositionCodec, DOT_COUNT>>>;
+};
+
+template <>
+struct SchemaOf<WorldUpdatePacket>
+{
+    using Type = Schema<WorldUpdatePacket,
+                        Field<&WorldUpdatePacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&WorldUpdatePacket::snapshotId, UIntCodec<uint32_t, UINT32_MAX>>,
+                        Field<&WorldUpdatePacket::baselineId, UIntCodec<uint32_t, UINT32_MAX>>,
+                        Field<&WorldUpdatePacket::time, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&WorldUpdatePacket::processedInputs, UIntCodec<uint64_t, UINT64_MAX>>,
+                        Field<&WorldUpdatePacket::fragmentIndex, UIntCodec<uint16_t, UINT16_MAX>>,
+                        Field<&WorldUpdatePacket::fragmentCount, UIntCodec<uint16_t, UINT16_MAX>>,
+                        Field<&WorldUpdatePacket::entryCount, UIntCodec<uint16_t, UINT16_MAX>>>;
+};
+
+template <>
+struct SchemaOf<SnapshotAckPacket>
+{
+    using Type = Schema<SnapshotAckPacket,
+                        Field<&SnapshotAckPacket::header, SchemaOf<PacketHeader>::Type>,
+                        Field<&SnapshotAckPacket::snapshotId, UIntCodec<uint32_t, UINT32_MAX>>>;
+};
+
+static_assert(SchemaOf<DotUpdatePacket>::Type::bytes <= MAX_DATAGRAM_SIZE);
+static_assert(SchemaOf<PlayerUpdatePacket>::Type::bytes <= MAX_DATAGRAM_SIZE);
+
+/* Size of a delta entry with the given flags */
+constexpr size_t DeltaEntryBits(uint8_t flags)
+{
+    return PlayerIdCodec::bits + DeltaFlagsCodec::bits +
+           ((flags & DELTA_POSITION) ? WorldPositionCodec::bits : 0) +
+           ((flags & DELTA_RADIUS) ? RadiusCodec::bits : 0);
+}
+
+constexpr size_t MAX_DELTA_ENTRY_BITS = DeltaEntryBits(DELTA_POSITION | DELTA_RADIUS);
+
+static_assert(SchemaOf<WorldUpdatePacket>::Type::bits + MAX_DELTA_ENTRY_BITS <= MAX_DATAGRAM_SIZE * 8);
+
+/* Entries are id, flags, then only the fields the flags name */
+void WriteDeltaEntry(BitWriter &writer, uint8_t flags, const PlayerState &state);
+
+/* Fills in only the fields present in the entry, check reader.Ok() afterwards */
+void ReadDeltaEntry(BitReader &reader, uint8_t &flags, PlayerState &state);
+
+constexpr size_t INPUT_RUN_BITS = InputCodec::bits + RunLengthCodec::bits;
+
+static_assert(SchemaOf<InputWindowPacket>::Type::bits + INPUT_WINDOW_SIZE * INPUT_RUN_BITS <= MAX_DATAGRAM_SIZE * 8);
+
+/* Runs are never empty, check reader.Ok() after reading */
+void WriteInputRun(BitWriter &writer, const InputRun &run);
+void ReadInputRun(BitReader &reader, InputRun &run);
+
+/*
+ * Run-length encodes inputs[0, count) after the header, count at most INPUT_WINDOW_SIZE. Returns the
+ * datagram's size, 0 if it didn't fit in capacity
+ */
+size_t EncodeInputWindow(char *buffer, size_t capacity, uint64_t firstSequence, const uint8_t *inputs, size_t count);
+
+/* Expands a window into inputs, which holds INPUT_WINDOW_SIZE. False if it is malformed */
+bool DecodeInputWindow(const char *buffer, int size, uint64_t &firstSequence, uint8_t *inputs, size_t &count);
+
+/* The type of an encoded packet, false if the datagram doesn't start with a valid one */
+bool PeekType(const char *buffer, int size, MSG &type);
+
+/* Moves in full precision and clamps to the world, positions are only quantized on the wire */
+void ApplyInput(Vector2 *position, uint8_t input, uint32_t radius);
\ No newline at end of file
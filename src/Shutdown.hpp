@@ -1,11 +1,27 @@
 #pragma once
 #include <csignal>
 #include <atomic>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 
 class Shutdown
 {
 private:
     static inline std::atomic<bool> shutdown_requested{false};
+    /* Self pipe, a byte is written on every request so wait() can block instead of polling the flag */
+    static inline int wake_fds[2]{-1, -1};
+
+    static void notify()
+    {
+        if (wake_fds[1] >= 0)
+        {
+            char byte = 1;
+            /* A full pipe already holds a wakeup */
+            [[maybe_unused]] ssize_t written = write(wake_fds[1], &byte, 1);
+        }
+    }
 
 public:
     static void signal_handler(int signal)
@@ -13,17 +29,47 @@ public:
         if (signal == SIGINT || signal == SIGTERM)
         {
             shutdown_requested = true;
+            notify();
         }
     }
 
     static void setup()
     {
+        if (wake_fds[0] < 0 && pipe(wake_fds) == 0)
+        {
+            for (int fd : wake_fds)
+            {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+        }
+
         std::signal(SIGINT, signal_handler);
         std::signal(SIGTERM, signal_handler);
     }
 
+    /* Same as receiving SIGINT, for in-process owners such as the load generator */
+    static void request()
+    {
+        shutdown_requested = true;
+        notify();
+    }
+
     static bool should_shutdown()
     {
         return shutdown_requested.load();
     }
+
+    /* Blocks until shutdown is requested. Call setup() first */
+    static void wait()
+    {
+        while (!should_shutdown())
+        {
+            pollfd fd{wake_fds[0], POLLIN, 0};
+            if (poll(&fd, 1, -1) < 0 && errno != EINTR)
+            {
+                return;
+            }
+        }
+    }
 };
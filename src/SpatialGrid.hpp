@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include "raylib.h"
+
+/*
+ * Uniform grid of points hashed into a fixed number of buckets, so the world needs no bounds.
+ * Objects are stored by their centre only, a query covers every cell overlapping the query circle
+ * and callers do the exact distance test. That keeps variable radii out of the grid: the radius
+ * belongs to whoever is asking.
+ *
+ * Buckets keep their capacity across Clear(), so rebuilding every tick stops allocating once warm.
+ */
+class SpatialGrid
+{
+private:
+    float mCellSize;
+    size_t mMask;
+    std::vector<std::vector<uint32_t>> mBuckets;
+    /* Buckets that hold something, so Clear() and whole-grid queries skip the empty ones */
+    std::vector<uint32_t> mOccupied;
+    /* Each occupied bucket's index in mOccupied, so an emptied one is swapped out in constant time */
+    std::vector<uint32_t> mOccupiedIndex;
+    /* Query() scratch, callers on other threads bring their own */
+    mutable std::vector<uint32_t> mVisited;
+
+    int Cell(float coordinate) const
+    {
+        return (int)std::floor(coordinate / mCellSize);
+    }
+
+    size_t Bucket(int cx, int cy) const
+    {
+        return (((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u)) & mMask;
+    }
+
+public:
+    explicit SpatialGrid(float cellSize, size_t bucketCount = 4096)
+        : mCellSize(cellSize), mMask(bucketCount - 1), mBuckets(bucketCount), mOccupiedIndex(bucketCount)
+    {
+        if (cellSize <= 0.0f)
+        {
+            throw std::invalid_argument("Cell size must be greater than 0");
+        }
+        if (bucketCount == 0 || (bucketCount & (bucketCount - 1)) != 0)
+        {
+            throw std::invalid_argument("Bucket count must be a power of two");
+        }
+    }
+
+    void Clear()
+    {
+        for (uint32_t bucket : mOccupied)
+        {
+            mBuckets[bucket].clear();
+        }
+        mOccupied.clear();
+    }
+
+    void Insert(uint32_t id, Vector2 position)
+    {
+        size_t bucket = Bucket(Cell(position.x), Cell(position.y));
+        if (mBuckets[bucket].empty())
+        {
+            mOccupiedIndex[bucket] = mOccupied.size();
+            mOccupied.push_back(bucket);
+        }
+        mBuckets[bucket].push_back(id);
+    }
+
+    /* position must be the one the id was inserted with */
+    bool Remove(uint32_t id, Vector2 position)
+    {
+        size_t bucket = Bucket(Cell(position.x), Cell(position.y));
+        auto &items = mBuckets[bucket];
+        auto it = std::find(items.begin(), items.end(), id);
+        if (it == items.end())
+        {
+            return false;
+        }
+
+        *it = items.back();
+        items.pop_back();
+
+        if (items.empty())
+        {
+            uint32_t last = mOccupied.back();
+            mOccupied[mOccupiedIndex[bucket]] = last;
+            mOccupiedIndex[last] = mOccupiedIndex[bucket];
+            mOccupied.pop_back();
+        }
+        return true;
+    }
+
+    void Move(uint32_t id, Vector2 from, Vector2 to)
+    {
+        if (Bucket(Cell(from.x), Cell(from.y)) == Bucket(Cell(to.x), Cell(to.y)))
+        {
+            return;
+        }
+        Remove(id, from);
+        Insert(id, to);
+    }
+
+    /* Appends every id whose cell overlaps the circle, each at most once. Results may lie outside the circle */
+    void Query(Vector2 center, float radius, std::vector<uint32_t> &out) const
+    {
+        Query(center, radius, out, mVisited);
+    }
+
+    /* Same, with caller owned scratch so queries can run concurrently once the grid is built */
+    void Query(Vector2 center, float radius, std::vector<uint32_t> &out, std::vector<uint32_t> &visited) const
+    {
+        int minX = Cell(center.x - radius), maxX = Cell(center.x + radius);
+        int minY = Cell(center.y - radius), maxY = Cell(center.y + radius);
+
+        visited.clear();
+
+        if ((size_t)(maxX - minX + 1) * (size_t)(maxY - minY + 1) >= mBuckets.size())
+        {
+            /* The circle spans more cells than there are buckets, every bucket is a candidate */
+            for (uint32_t bucket : mOccupied)
+            {
+                visited.push_back(bucket);
+            }
+        }
+        else
+        {
+            for (int cy = minY; cy <= maxY; cy++)
+            {
+                for (int cx = minX; cx <= maxX; cx++)
+                {
+                    visited.push_back(Bucket(cx, cy));
+                }
+            }
+        }
+
+        /* Distinct cells can share a bucket */
+        std::sort(visited.begin(), visited.end());
+        visited.erase(std::unique(visited.begin(), visited.end()), visited.end());
+
+        for (uint32_t bucket : visited)
+        {
+            out.insert(out.end(), mBuckets[bucket].begin(), mBuckets[bucket].end());
+        }
+    }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <cerrno>
+
+/*
+ * Fixed rate tick clock. Tick n is due at a deadline computed from the start, never from when the
+ * previous tick finished, so time spent ticking or oversleeping doesn't accumulate into drift.
+ * Sleeping is an absolute clock_nanosleep on CLOCK_MONOTONIC (sleep_until elsewhere), optionally
+ * ending a little early and spinning the rest of the way for sub-millisecond accuracy.
+ *
+ * A tick that overruns leaves later deadlines in the past. Skip runs only the newest due tick and
+ * drops the others; CatchUp runs the missed ticks back to back, up to a limit beyond which it skips
+ * too, so a long stall can't turn into a spiral of ever later ticks.
+ */
+class TickScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class OverrunPolicy
+    {
+        Skip,
+        CatchUp
+    };
+
+    /* Ticks [first, first + count) are due now */
+    struct Due
+    {
+        uint64_t first;
+        uint64_t count;
+    };
+
+private:
+    std::chrono::nanoseconds mInterval;
+    OverrunPolicy mPolicy{OverrunPolicy::Skip};
+    uint64_t mMaxCatchUp{4};
+    std::chrono::nanoseconds mSpin{0};
+
+    /* Deadlines are counted from here, moved whenever the rate changes */
+    Clock::time_point mBaseTime;
+    uint64_t mBaseTick{0};
+    uint64_t mNext{0};
+    uint64_t mSkipped{0};
+
+    static void SleepUntil(Clock::time_point deadline)
+    {
+#ifdef __linux__
+        /* steady_clock is CLOCK_MONOTONIC on Linux */
+        auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        timespec until{.tv_sec = (time_t)(since / 1000000000), .tv_nsec = (long)(since % 1000000000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR)
+        {
+        }
+#else
+        std::this_thread::sleep_until(deadline);
+#endif
+    }
+
+public:
+    explicit TickScheduler(double hz = 10.0) : mInterval(std::chrono::nanoseconds((int64_t)(1e9 / hz)))
+    {
+    }
+
+    /* Tick 0 is due at start */
+    void Start(Clock::time_point start)
+    {
+        mBaseTime = start;
+        mBaseTick = 0;
+        mNext = 0;
+        mSkipped = 0;
+    }
+
+    /* Takes effect from the next tick, whose deadline stays where it was */
+    void SetRate(double hz)
+    {
+        mBaseTime = Deadline(mNext);
+        mBaseTick = mNext;
+        mInterval = std::chrono::nanoseconds((int64_t)(1e9 / std::max(hz, 0.1)));
+    }
+
+    void SetPolicy(OverrunPolicy policy, uint64_t maxCatchUp = 4)
+    {
+        mPolicy = policy;
+        mMaxCatchUp = std::max<uint64_t>(maxCatchUp, 1);
+    }
+
+    /* Wakes this long before each deadline and busy waits the rest */
+    void SetSpin(std::chrono::nanoseconds spin)
+    {
+        mSpin = spin;
+    }
+
+    std::chrono::nanoseconds Interval() const
+    {
+        return mInterval;
+    }
+
+    Clock::time_point Deadline(uint64_t tick) const
+    {
+        return mBaseTime + mInterval * (int64_t)(tick - mBaseTick);
+    }
+
+    /* Ticks dropped by the overrun policy so far */
+    uint64_t Skipped() const
+    {
+        return mSkipped;
+    }
+
+    /* Claims whatever is due at now, count is 0 if the next tick isn't due yet */
+    Due Poll(Clock::time_point now)
+    {
+        if (now < Deadline(mNext))
+        {
+            return {.first = mNext, .count = 0};
+        }
+
+        uint64_t behind = (uint64_t)((now - Deadline(mNext)) / mInterval) + 1;
+        uint64_t run = mPolicy == OverrunPolicy::CatchUp ? std::min(behind, mMaxCatchUp) : 1;
+
+        mSkipped += behind - run;
+        Due due{.first = mNext + behind - run, .count = run};
+        mNext += behind;
+        return due;
+    }
+
+    /* Sleeps until the next tick is due, then claims it and any others that are */
+    Due Wait()
+    {
+        Clock::time_point deadline = Deadline(mNext);
+
+        if (Clock::now() < deadline - mSpin)
+        {
+            SleepUntil(deadline - mSpin);
+        }
+        while (Clock::now() < deadline)
+        {
+        }
+
+        return Poll(Clock::now());
+    }
+};
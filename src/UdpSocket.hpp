@@ -9,17 +9,197 @@
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/filter.h>
+#endif
+#include "EventLoop.hpp"
+
+struct Datagram
+{
+    char *data;
+    int size;
+    sockaddr_in address;
+};
+
+/*
+ * Outgoing datagrams waiting for UdpSocket::Flush(), payloads stored back to back. A socket has one
+ * of its own, callers on other threads keep their own queue and flush it through the shared socket.
+ */
+class SendQueue
+{
+    friend class UdpSocket;
+
+    struct PendingSend
+    {
+        size_t offset;
+        int size;
+        sockaddr_in address;
+    };
+
+    std::vector<char> mBuffer;
+    std::vector<PendingSend> mPending;
+#ifdef __linux__
+    /* Flush() scratch, kept with the queue so flushes from different threads don't share it */
+    std::vector<mmsghdr> mMessages;
+    std::vector<iovec> mIovecs;
+    std::vector<char> mControl;
+    /* Index into mPending of each message's first datagram, plus the queue's size at the end */
+    std::vector<size_t> mRunStarts;
+#endif
+
+public:
+    /* An empty datagram is a packet that failed to encode, it is dropped */
+    void Push(const void *data, int size, const sockaddr_in &dest)
+    {
+        if (size <= 0)
+        {
+            return;
+        }
+
+        size_t offset = mBuffer.size();
+        mBuffer.insert(mBuffer.end(), (const char *)data, (const char *)data + size);
+        mPending.push_back({offset, size, dest});
+    }
+
+    bool empty() const
+    {
+        return mPending.empty();
+    }
+
+    /* Datagrams queued */
+    size_t size() const
+    {
+        return mPending.size();
+    }
+
+    /* Payload bytes queued */
+    size_t bytes() const
+    {
+        return mBuffer.size();
+    }
+
+    void clear()
+    {
+        mPending.clear();
+        mBuffer.clear();
+    }
+};
 
 class UdpSocket
 {
 
 private:
     int mSockFd{-1};
-    const unsigned int mMaxPacketSize{1024};
+    unsigned int mMaxPacketSize{1500};
+    int mBatchSize{32};
+    /* Cleared by whichever thread first sees the driver refuse GSO */
+    std::atomic<bool> mGsoEnabled{false};
     std::atomic<bool> mReceiving{false};
     std::thread mReceiveThread;
 
-    std::function<void(char *buffer, int bytesRead, sockaddr_in sender)> mCallback = nullptr;
+    std::function<void(Datagram *datagrams, int count)> mCallback = nullptr;
+
+    SendQueue mSendQueue;
+
+    /* Receive buffers for one batch, sized by PrepareReceive() */
+    std::vector<char> mRecvBuffers;
+    std::vector<Datagram> mRecvDatagrams;
+#ifdef __linux__
+    std::vector<mmsghdr> mRecvMessages;
+    std::vector<iovec> mRecvIovecs;
+    std::vector<sockaddr_in> mRecvSenders;
+    /* SendToMany() scratch */
+    std::vector<mmsghdr> mSendMessages;
+#endif
+
+    void PrepareReceive()
+    {
+        mRecvBuffers.resize(mBatchSize * mMaxPacketSize);
+        mRecvDatagrams.resize(mBatchSize);
+
+#ifdef __linux__
+        mRecvMessages.resize(mBatchSize);
+        mRecvIovecs.resize(mBatchSize);
+        mRecvSenders.resize(mBatchSize);
+
+        for (int i = 0; i < mBatchSize; i++)
+        {
+            mRecvIovecs[i].iov_base = &mRecvBuffers[i * mMaxPacketSize];
+            mRecvIovecs[i].iov_len = mMaxPacketSize - 1;
+        }
+#endif
+    }
+
+    /*
+     * Reads up to one batch of datagrams and hands them to the callback.
+     * Returns the number received, 0 if nothing was ready and -1 on a socket error.
+     */
+    int ReceiveBatch(bool wait)
+    {
+        const int batchSize = mRecvDatagrams.size();
+
+#ifdef __linux__
+        for (int i = 0; i < batchSize; i++)
+        {
+            memset(&mRecvMessages[i].msg_hdr, 0, sizeof(msghdr));
+            mRecvMessages[i].msg_hdr.msg_name = &mRecvSenders[i];
+            mRecvMessages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            mRecvMessages[i].msg_hdr.msg_iov = &mRecvIovecs[i];
+            mRecvMessages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int count = recvmmsg(mSockFd, mRecvMessages.data(), batchSize, wait ? MSG_WAITFORONE : MSG_DONTWAIT, nullptr);
+
+        for (int i = 0; i < count; i++)
+        {
+            char *buffer = &mRecvBuffers[i * mMaxPacketSize];
+            int bytesRead = mRecvMessages[i].msg_len;
+            buffer[bytesRead] = '\0';
+            mRecvDatagrams[i] = {buffer, bytesRead, mRecvSenders[i]};
+        }
+#else
+        /* No recvmmsg, read the first datagram as asked then drain whatever else is already queued */
+        int count = 0;
+
+        while (count < batchSize)
+        {
+            char *buffer = &mRecvBuffers[count * mMaxPacketSize];
+            sockaddr_in sender;
+            socklen_t senderSize = sizeof(sender);
+
+            int bytesRead = recvfrom(mSockFd, buffer, mMaxPacketSize - 1, (count || !wait) ? MSG_DONTWAIT : 0, (struct sockaddr *)&sender, &senderSize);
+            if (bytesRead <= 0)
+            {
+                if (count == 0 && bytesRead < 0)
+                {
+                    count = -1;
+                }
+                break;
+            }
+
+            buffer[bytesRead] = '\0';
+            mRecvDatagrams[count++] = {buffer, bytesRead, sender};
+        }
+#endif
+
+        if (count > 0)
+        {
+            mCallback(mRecvDatagrams.data(), count);
+            return count;
+        }
+
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            std::cerr << "Error in receive thread: " << strerror(errno) << '\n';
+            return -1;
+        }
+
+        return 0;
+    }
 
 public:
     sockaddr_in mBoundAddress;
@@ -33,7 +213,8 @@ public:
     UdpSocket(const UdpSocket &) = delete;
     UdpSocket &operator=(const UdpSocket &) = delete;
 
-    bool Create(const char *ip, unsigned short port)
+    /* With reusePort, several sockets can bind the same address and the kernel spreads datagrams over them */
+    bool Create(const char *ip, unsigned short port, bool reusePort = false)
     {
 
         if (mSockFd >= 0)
@@ -50,6 +231,13 @@ public:
 
         mBoundAddress = UdpSocket::CreateAddress(ip, port);
 
+        int enable = 1;
+        if (reusePort && setsockopt(mSockFd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+        {
+            std::cerr << "Failed to set SO_REUSEPORT: " << strerror(errno) << '\n';
+            return false;
+        }
+
         int result = bind(mSockFd, (struct sockaddr *)&mBoundAddress, sizeof(mBoundAddress));
         if (result < 0)
         {
@@ -57,9 +245,46 @@ public:
             return false;
         }
 
+#if defined(__linux__) && defined(UDP_SEGMENT)
+        int segment = 0;
+        socklen_t segmentSize = sizeof(segment);
+        mGsoEnabled = getsockopt(mSockFd, SOL_UDP, UDP_SEGMENT, &segment, &segmentSize) == 0;
+#endif
+
         return true;
     }
 
+    /*
+     * Replaces the kernel's 4-tuple hash for this socket's SO_REUSEPORT group with
+     * (source address ^ source port) % shardCount, an index into the group in bind order. A client
+     * keeps its shard even as sockets join or leave, as long as the count stays the same.
+     * Assumes IPv4 headers without options, Linux only.
+     */
+    bool SteerBySource(unsigned int shardCount)
+    {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+        sock_filter code[] = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + 12)),
+            BPF_STMT(BPF_MISC | BPF_TAX, 0),
+            BPF_STMT(BPF_LD | BPF_H | BPF_ABS, (uint32_t)(SKF_NET_OFF + 20)),
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shardCount),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        sock_fprog program{.len = sizeof(code) / sizeof(code[0]), .filter = code};
+
+        if (setsockopt(mSockFd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0)
+        {
+            std::cerr << "Failed to attach reuseport program: " << strerror(errno) << '\n';
+            return false;
+        }
+        return true;
+#else
+        (void)shardCount;
+        return false;
+#endif
+    }
+
     static sockaddr_in CreateAddress(const char *ip, unsigned short port)
     {
         sockaddr_in addr;
@@ -90,40 +315,27 @@ public:
             return;
         }
 
-        char buffer[mMaxPacketSize];
-        sockaddr_in sender;
-
         while (mReceiving)
         {
-            socklen_t senderSize = sizeof(sender);
-
-            int bytesRead = recvfrom(mSockFd, buffer, mMaxPacketSize, 0, (struct sockaddr *)&sender, &senderSize);
-
-            if (bytesRead > 0)
+            if (ReceiveBatch(true) < 0)
             {
-
-                buffer[bytesRead < mMaxPacketSize ? bytesRead : mMaxPacketSize - 1] = '\0';
-
-                mCallback(buffer, bytesRead, sender);
-            }
-            else if (bytesRead < 0)
-            {
-
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
-                {
-                    continue;
-                }
-                else
-                {
-
-                    std::cerr << "Error in receive thread: " << strerror(errno) << '\n';
-                    break;
-                }
+                break;
             }
         }
     }
 
     bool StartReceiveThread(std::chrono::milliseconds time, std::function<void(char *buffer, int bytesRead, sockaddr_in sender)> callback)
+    {
+        return StartReceiveThread(time, [callback](Datagram *datagrams, int count)
+                                  {
+                                      for (int i = 0; i < count; i++)
+                                      {
+                                          callback(datagrams[i].data, datagrams[i].size, datagrams[i].address);
+                                      }
+                                  });
+    }
+
+    bool StartReceiveThread(std::chrono::milliseconds time, std::function<void(Datagram *datagrams, int count)> callback)
     {
         if (mSockFd < 0)
         {
@@ -148,6 +360,7 @@ public:
             return false;
         }
 
+        PrepareReceive();
         mReceiving = true;
 
         mReceiveThread = std::thread(&UdpSocket::Receive, this);
@@ -155,6 +368,49 @@ public:
         return true;
     }
 
+    /* Delivers datagrams from the loop's thread instead of a dedicated receive thread */
+    bool StartReceiving(EventLoop &loop, std::function<void(Datagram *datagrams, int count)> callback)
+    {
+        if (mSockFd < 0)
+        {
+            std::cerr << "Socket not created, call 'Create()' first\n";
+            return false;
+        }
+        if (mReceiving)
+        {
+            std::cerr << "Already receiving\n";
+            return false;
+        }
+
+        mCallback = callback;
+        fcntl(mSockFd, F_SETFL, fcntl(mSockFd, F_GETFL, 0) | O_NONBLOCK);
+        PrepareReceive();
+
+        mReceiving = true;
+
+        /* Bounded so a flooded socket can't starve the loop's other handlers */
+        const int maxBatchesPerWake = 4;
+        return loop.AddReader(mSockFd, [this]()
+                              {
+                                  for (int i = 0; i < maxBatchesPerWake && mReceiving; i++)
+                                  {
+                                      if (ReceiveBatch(false) <= 0)
+                                      {
+                                          break;
+                                      }
+                                  } });
+    }
+
+    bool StartReceiving(EventLoop &loop, std::function<void(char *buffer, int bytesRead, sockaddr_in sender)> callback)
+    {
+        return StartReceiving(loop, [callback](Datagram *datagrams, int count)
+                              {
+                                  for (int i = 0; i < count; i++)
+                                  {
+                                      callback(datagrams[i].data, datagrams[i].size, datagrams[i].address);
+                                  } });
+    }
+
     int SendTo(const void *data, int size, const sockaddr_in &dest)
     {
         if (mSockFd < 0)
@@ -162,15 +418,259 @@ public:
             std::cerr << "Socket not created, call 'Create()' first\n";
             return -1;
         }
+        if (size <= 0)
+        {
+            std::cerr << "Refusing to send an empty datagram, the packet failed to encode\n";
+            return -1;
+        }
 
         int bytesSent = sendto(mSockFd, data, size, 0, (struct sockaddr *)&dest, sizeof(dest));
-        if (bytesSent < 0)
+        /* A full send buffer on a non-blocking socket is a drop the caller counts, not an error */
+        if (bytesSent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
         {
             std::cerr << "Failed to send data: " << strerror(errno) << '\n';
         }
         return bytesSent;
     }
 
+    /*
+     * Sends the same payload to every destination, one sendmmsg per mBatchSize destinations. Returns
+     * the number actually sent, a full send buffer drops the rest. Not thread safe
+     */
+    int SendToMany(const void *data, int size, const sockaddr_in *dests, int count)
+    {
+        if (mSockFd < 0)
+        {
+            std::cerr << "Socket not created, call 'Create()' first\n";
+            return -1;
+        }
+        if (size <= 0)
+        {
+            std::cerr << "Refusing to send an empty datagram, the packet failed to encode\n";
+            return -1;
+        }
+
+        int sent = 0;
+
+#ifdef __linux__
+        iovec iov{const_cast<void *>(data), (size_t)size};
+        std::vector<mmsghdr> &messages = mSendMessages;
+        messages.resize(std::max<size_t>(messages.size(), std::min(count, mBatchSize)));
+
+        for (int done = 0; done < count;)
+        {
+            int batch = std::min(count - done, mBatchSize);
+            for (int i = 0; i < batch; i++)
+            {
+                memset(&messages[i], 0, sizeof(mmsghdr));
+                messages[i].msg_hdr.msg_name = const_cast<sockaddr_in *>(&dests[done + i]);
+                messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                messages[i].msg_hdr.msg_iov = &iov;
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int result = sendmmsg(mSockFd, messages.data(), batch, 0);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                std::cerr << "Failed to send data: " << strerror(errno) << '\n';
+                /* Skip the datagram that failed so one bad destination doesn't stall the rest */
+                done++;
+                continue;
+            }
+            sent += result;
+            done += result;
+        }
+#else
+        for (int i = 0; i < count; i++)
+        {
+            if (SendTo(data, size, dests[i]) >= 0)
+            {
+                sent++;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+        }
+#endif
+        return sent;
+    }
+
+    /* Copies the datagram into the send queue, it goes out on the next Flush(). Not thread safe */
+    void QueueSend(const void *data, int size, const sockaddr_in &dest)
+    {
+        mSendQueue.Push(data, size, dest);
+    }
+
+    int Flush()
+    {
+        return Flush(mSendQueue);
+    }
+
+    /*
+     * Sends and clears everything in queue. Runs of equally sized datagrams to the same destination
+     * are coalesced into a single UDP_SEGMENT (GSO) send when the kernel supports it. Threads may
+     * flush their own queues through the same socket concurrently.
+     * Returns the datagrams actually sent, on a non-blocking socket a full send buffer drops the rest.
+     */
+    int Flush(SendQueue &queue)
+    {
+        if (queue.empty())
+        {
+            return 0;
+        }
+
+        const std::vector<SendQueue::PendingSend> &pending = queue.mPending;
+        std::vector<char> &buffer = queue.mBuffer;
+
+        int sent = 0;
+
+#ifdef __linux__
+        const size_t queued = pending.size();
+        const bool gso = mGsoEnabled;
+        std::vector<mmsghdr> &messages = queue.mMessages;
+        std::vector<iovec> &iovecs = queue.mIovecs;
+        std::vector<char> &control = queue.mControl;
+        std::vector<size_t> &runStarts = queue.mRunStarts;
+        messages.clear();
+        runStarts.clear();
+        iovecs.resize(std::max(iovecs.size(), queued));
+#ifdef UDP_SEGMENT
+        control.resize(std::max(control.size(), queued * CMSG_SPACE(sizeof(uint16_t))));
+#endif
+
+        for (size_t i = 0; i < queued;)
+        {
+            const SendQueue::PendingSend &first = pending[i];
+            size_t run = 1;
+
+            if (gso)
+            {
+                /* GSO segments must all share the first segment's size, only the last may be shorter */
+                size_t length = first.size;
+                while (i + run < queued && run < 64 &&
+                       pending[i + run].address.sin_addr.s_addr == first.address.sin_addr.s_addr &&
+                       pending[i + run].address.sin_port == first.address.sin_port &&
+                       pending[i + run].offset == first.offset + length &&
+                       pending[i + run].size <= first.size &&
+                       pending[i + run - 1].size == first.size &&
+                       length + pending[i + run].size <= 65000)
+                {
+                    length += pending[i + run].size;
+                    run++;
+                }
+                iovecs[messages.size()] = {&buffer[first.offset], length};
+            }
+            else
+            {
+                iovecs[messages.size()] = {&buffer[first.offset], (size_t)first.size};
+            }
+
+            mmsghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_hdr.msg_name = const_cast<sockaddr_in *>(&first.address);
+            message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            message.msg_hdr.msg_iov = &iovecs[messages.size()];
+            message.msg_hdr.msg_iovlen = 1;
+
+#ifdef UDP_SEGMENT
+            if (run > 1)
+            {
+                char *cmsgBuffer = &control[messages.size() * CMSG_SPACE(sizeof(uint16_t))];
+                message.msg_hdr.msg_control = cmsgBuffer;
+                message.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segmentSize = first.size;
+                memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+            }
+#endif
+            messages.push_back(message);
+            runStarts.push_back(i);
+            i += run;
+        }
+        runStarts.push_back(queued);
+
+        size_t done = 0;
+        while (done < messages.size())
+        {
+            int batch = std::min((int)(messages.size() - done), mBatchSize);
+            int result = sendmmsg(mSockFd, &messages[done], batch, 0);
+            if (result >= 0)
+            {
+                sent += (int)(runStarts[done + result] - runStarts[done]);
+                done += result;
+                continue;
+            }
+
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                /* The send buffer is full, the rest of the queue is dropped and left for the caller to count */
+                break;
+            }
+            if (errno == EIO && gso)
+            {
+                /* The NIC/driver refused segmentation offload, stop using it and send this run one by one */
+                mGsoEnabled = false;
+                for (size_t j = runStarts[done]; j < runStarts[done + 1]; j++)
+                {
+                    if (SendTo(&buffer[pending[j].offset], pending[j].size, pending[j].address) >= 0)
+                    {
+                        sent++;
+                    }
+                }
+            }
+            else
+            {
+                std::cerr << "Failed to send data: " << strerror(errno) << '\n';
+            }
+            done++;
+        }
+#else
+        for (auto &send : pending)
+        {
+            if (SendTo(&buffer[send.offset], send.size, send.address) >= 0)
+            {
+                sent++;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+        }
+#endif
+
+        queue.clear();
+        return sent;
+    }
+
+    /* Datagrams per recvmmsg/sendmmsg. Not synchronised with I/O, set it before receiving or sending starts */
+    void SetBatchSize(int batchSize)
+    {
+        mBatchSize = std::max(batchSize, 1);
+    }
+
+    /* Largest datagram the receive side accepts, longer ones are truncated. Set before receiving starts */
+    void SetMaxPacketSize(unsigned int maxPacketSize)
+    {
+        mMaxPacketSize = std::max(maxPacketSize, 2u);
+    }
+
     void Close()
     {
         mReceiving = false;
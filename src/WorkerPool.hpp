@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Fixed set of threads for data parallel loops. ParallelFor deals the indices out as one contiguous
+ * range per participant, the calling thread included, and a participant that runs out steals single
+ * indices from the back of someone else's range, so uneven tasks still finish together.
+ *
+ * A range is packed as (begin << 32 | end) in one atomic, the owner takes from the front and thieves
+ * from the back, both by compare-and-swap. Tasks never add work, so once every range is empty a
+ * participant is done.
+ */
+class WorkerPool
+{
+    struct alignas(64) Range
+    {
+        std::atomic<uint64_t> bounds{0};
+    };
+
+private:
+    std::vector<std::thread> mThreads;
+    std::unique_ptr<Range[]> mRanges;
+    size_t mSize;
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    uint64_t mGeneration{0};
+    size_t mBusy{0};
+    bool mStopping{false};
+    const std::function<void(size_t, size_t)> *mTask{nullptr};
+
+    static uint64_t Pack(uint64_t begin, uint64_t end)
+    {
+        return begin << 32 | end;
+    }
+
+    bool TakeFront(Range &range, size_t &index)
+    {
+        uint64_t bounds = range.bounds.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            uint64_t begin = bounds >> 32, end = bounds & 0xffffffff;
+            if (begin >= end)
+            {
+                return false;
+            }
+            if (range.bounds.compare_exchange_weak(bounds, Pack(begin + 1, end), std::memory_order_relaxed))
+            {
+                index = begin;
+                return true;
+            }
+        }
+    }
+
+    bool TakeBack(Range &range, size_t &index)
+    {
+        uint64_t bounds = range.bounds.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            uint64_t begin = bounds >> 32, end = bounds & 0xffffffff;
+            if (begin >= end)
+            {
+                return false;
+            }
+            if (range.bounds.compare_exchange_weak(bounds, Pack(begin, end - 1), std::memory_order_relaxed))
+            {
+                index = end - 1;
+                return true;
+            }
+        }
+    }
+
+    void Work(size_t worker)
+    {
+        const auto &task = *mTask;
+        size_t index;
+
+        while (TakeFront(mRanges[worker], index))
+        {
+            task(index, worker);
+        }
+
+        for (size_t offset = 1; offset < mSize; offset++)
+        {
+            Range &victim = mRanges[(worker + offset) % mSize];
+            while (TakeBack(victim, index))
+            {
+                task(index, worker);
+            }
+        }
+    }
+
+    void WorkerMain(size_t worker)
+    {
+        uint64_t seen = 0;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [&]()
+                           { return mStopping || mGeneration != seen; });
+                if (mStopping)
+                {
+                    return;
+                }
+                seen = mGeneration;
+            }
+
+            Work(worker);
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (--mBusy == 0)
+            {
+                mDone.notify_one();
+            }
+        }
+    }
+
+public:
+    /* threads counts the calling thread, a pool of one runs everything inline */
+    explicit WorkerPool(size_t threads) : mRanges(std::make_unique<Range[]>(std::max<size_t>(threads, 1))),
+                                          mSize(std::max<size_t>(threads, 1))
+    {
+        for (size_t worker = 1; worker < mSize; worker++)
+        {
+            mThreads.emplace_back(&WorkerPool::WorkerMain, this, worker);
+        }
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mWake.notify_all();
+
+        for (auto &thread : mThreads)
+        {
+            thread.join();
+        }
+    }
+
+    size_t size() const
+    {
+        return mSize;
+    }
+
+    /*
+     * Calls task(index, worker) once for every index in [0, count) and returns when all have run.
+     * worker is below size() and no two tasks run with the same worker at once, so it can pick
+     * per thread scratch space. Not reentrant.
+     */
+    void ParallelFor(size_t count, const std::function<void(size_t, size_t)> &task)
+    {
+        if (mSize == 1 || count <= 1)
+        {
+            for (size_t index = 0; index < count; index++)
+            {
+                task(index, 0);
+            }
+            return;
+        }
+
+        for (size_t worker = 0; worker < mSize; worker++)
+        {
+            mRanges[worker].bounds.store(Pack(count * worker / mSize, count * (worker + 1) / mSize),
+                                         std::memory_order_relaxed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTask = &task;
+            mBusy = mThreads.size();
+            mGeneration++;
+        }
+        mWake.notify_all();
+
+        Work(0);
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [&]()
+                   { return mBusy == 0; });
+        mTask = nullptr;
+    }
+};
@@ -1,36 +1,229 @@
 #include "Server.hpp"
 #include "Client.hpp"
+#include "RoomManager.hpp"
+#include "Bench.hpp"
+#include "Replay.hpp"
+#include "LoadGenerator.hpp"
 
 int main(int argc, char **argv)
 {
 
     if (argc < 2)
     {
-        std::cerr << "Usage: " << argv[0] << " server|client [client_port]\n";
+        std::cerr << "Usage: " << argv[0] << " server|rooms|client [client_port]|loadgen|bench|replay [capture] [--event-loop] [--threads n] [--room-size n]"
+                  << " [--bind address] [--shards n] [--steer] [--headless] [--bots n] [--first-port port]"
+                  << " [--duration s] [--input random|circle|idle] [--local] [--json] [--filter name]"
+                  << " [--stats-port port] [--stats-interval s] [--tick-rate hz] [--tick-policy skip|catch-up]"
+                  << " [--tick-spin us] [--send-every frames] [--extrapolate ms] [--capture path] [--repeat n] [--lockstep]"
+                  << " [--interest-radius r] [--interest-exit-radius r]\n";
         return 1;
     }
 
     int serverPort = 5050;
+    NetBackend backend = NetBackend::Thread;
+    int threads = 1;
+    int roomSize = 16;
+    const char *bindAddress = "127.0.0.1";
+    int shards = 1;
+    bool steer = false;
+    bool headless = false;
+    int statsPort = 0;
+    int statsInterval = 0;
+    double tickRate = 10.0;
+    TickScheduler::OverrunPolicy overrunPolicy = TickScheduler::OverrunPolicy::Skip;
+    int tickSpin = 0;
+    int sendEvery = 0;
+    float extrapolate = 100.0f;
+    const char *capturePath = "";
+    bool lockstep = false;
+    float interestRadius = DEFAULT_INTEREST_RADIUS;
+    /* 0 keeps the default's ratio to whatever --interest-radius says */
+    float interestExitRadius = 0.0f;
+    ReplayOptions replay;
+    LoadOptions load;
+    BenchOptions bench;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--event-loop") == 0)
+        {
+            backend = NetBackend::EventLoop;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--room-size") == 0 && i + 1 < argc)
+        {
+            roomSize = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc)
+        {
+            bindAddress = argv[++i];
+        }
+        else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+        {
+            shards = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--steer") == 0)
+        {
+            steer = true;
+        }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--bots") == 0 && i + 1 < argc)
+        {
+            load.bots = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--first-port") == 0 && i + 1 < argc)
+        {
+            load.firstPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc)
+        {
+            load.durationSeconds = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc)
+        {
+            load.input = argv[++i];
+        }
+        else if (strcmp(argv[i], "--local") == 0)
+        {
+            load.local = true;
+        }
+        else if (strcmp(argv[i], "--stats-port") == 0 && i + 1 < argc)
+        {
+            statsPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc)
+        {
+            statsInterval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc)
+        {
+            tickRate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tick-policy") == 0 && i + 1 < argc)
+        {
+            overrunPolicy = strcmp(argv[++i], "catch-up") == 0 ? TickScheduler::OverrunPolicy::CatchUp
+                                                               : TickScheduler::OverrunPolicy::Skip;
+        }
+        else if (strcmp(argv[i], "--tick-spin") == 0 && i + 1 < argc)
+        {
+            tickSpin = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--send-every") == 0 && i + 1 < argc)
+        {
+            sendEvery = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--extrapolate") == 0 && i + 1 < argc)
+        {
+            extrapolate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            capturePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--lockstep") == 0)
+        {
+            lockstep = true;
+        }
+        else if (strcmp(argv[i], "--interest-radius") == 0 && i + 1 < argc)
+        {
+            interestRadius = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--interest-exit-radius") == 0 && i + 1 < argc)
+        {
+            interestExitRadius = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            replay.repeat = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            bench.json = true;
+            replay.json = true;
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            bench.filter = argv[++i];
+        }
+    }
+
+    if (interestExitRadius <= 0.0f)
+    {
+        interestExitRadius = interestRadius * (DEFAULT_INTEREST_EXIT_RADIUS / DEFAULT_INTEREST_RADIUS);
+    }
 
     if (strcmp(argv[1], "server") == 0)
     {
 
         Server server(serverPort);
-        server.Attach();
+        server.SetWorkerThreads(threads);
+        server.SetBindAddress(bindAddress);
+        server.SetShards(shards, steer);
+        server.SetStatsPort(statsPort);
+        server.SetStatsInterval(statsInterval);
+        server.SetTickRate(tickRate);
+        server.SetOverrunPolicy(overrunPolicy);
+        server.SetTickSpin(std::chrono::microseconds(tickSpin));
+        server.SetCapture(capturePath);
+        server.SetLockstep(lockstep);
+        server.SetInterestRadius(interestRadius, interestExitRadius);
+        server.Attach(backend);
         server.Run();
     }
+    else if (strcmp(argv[1], "rooms") == 0)
+    {
+        /* Many matches on one port, threads tick rooms rather than sharding one world */
+        RoomManager rooms(serverPort, threads);
+        rooms.SetRoomCapacity(roomSize);
+        rooms.SetBindAddress(bindAddress);
+        rooms.SetInterestRadius(interestRadius, interestExitRadius);
+        rooms.Run();
+    }
     else if (strcmp(argv[1], "client") == 0 && argc > 2)
     {
 
         int clientPort = atoi(argv[2]);
 
         Client client(clientPort, serverPort);
-        client.Attach();
+        if (headless)
+        {
+            client.SetHeadless({});
+        }
+        client.SetInputWindow(sendEvery);
+        client.SetExtrapolationLimit(extrapolate);
+        client.SetLockstep(lockstep);
+        client.Attach(backend);
         client.Run();
     }
+    else if (strcmp(argv[1], "loadgen") == 0)
+    {
+        load.serverPort = serverPort;
+        load.threads = threads;
+        load.sendEvery = sendEvery;
+        load.lockstep = lockstep;
+        load.interestRadius = interestRadius;
+        load.interestExitRadius = interestExitRadius;
+        return RunLoadGenerator(load);
+    }
+    else if (strcmp(argv[1], "bench") == 0)
+    {
+        return RunBenchmarks(bench);
+    }
+    else if (strcmp(argv[1], "replay") == 0 && argc > 2)
+    {
+        replay.path = argv[2];
+        replay.threads = threads;
+        return RunReplay(replay);
+    }
     else
     {
-        std::cerr << "Invalid arguments. Use 'server' or 'client [port]'\n";
+        std::cerr << "Invalid arguments. Use 'server', 'rooms', 'client [port]', 'loadgen', 'bench' or 'replay [capture]'\n";
         return 1;
     }
 